@@ -0,0 +1,44 @@
+#!/bin/bash
+#SBATCH --job-name=autotune           # Nom du job
+#SBATCH --nodes=1                     # Nombre de nœuds
+#SBATCH --ntasks=4                    # Nombre de processus MPI
+#SBATCH --cpus-per-task=6             # Nombre de cœurs par processus pour OpenMP
+#SBATCH --exclusive                   # Réservation exclusive du nœud
+#SBATCH --time=01:00:00               # Temps limite du job (1 heure)
+#SBATCH --output=autotune_%j.out      # Fichier de sortie (%j sera remplacé par le job ID)
+#SBATCH --error=autotune_%j.err       # Fichier d’erreur
+
+module purge
+module load compiler/gcc/12.2.0 mpi/openmpi/4.1.5
+
+# Répertoire de soumission
+cd $SLURM_SUBMIT_DIR
+
+# Compilation du code
+make clean && make
+
+# Fichier de wisdom partagé par les exécutions suivantes
+export STENCIL_WISDOM=$SLURM_SUBMIT_DIR/stencil.wisdom
+export OMP_PLACES="cores"
+export OMP_PROC_BIND="close"
+
+# Tailles à calibrer
+STENCIL_SIZES=(26 50 98 194)
+
+for SIZE in "${STENCIL_SIZES[@]}"; do
+    echo "Autotuning stencil size $SIZE"
+
+    # OpenMP : nombre de threads jusqu'à tous les cœurs du nœud
+    OMP_NUM_THREADS=24 srun --ntasks=1 --cpus-per-task=24 --cpu-bind=cores bin/stencil_omp $SIZE -a
+
+    # MPI : forme de la grille de processus
+    srun --ntasks=4 --cpus-per-task=1 --cpu-bind=cores bin/stencil_mpi $SIZE -a
+
+    # Hybride : forme de la grille et nombre de threads par processus
+    OMP_NUM_THREADS=6 srun --ntasks=4 --cpus-per-task=6 --cpu-bind=cores bin/stencil_hybrid $SIZE -a
+done
+
+cat $STENCIL_WISDOM
+
+# Nettoyage après les tests
+make clean
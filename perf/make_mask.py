@@ -0,0 +1,39 @@
+import argparse
+
+# Génération de masques de géométrie pour l'option -m de toutes les versions :
+# image PGM binaire (P5) de la grille entière, bords compris ; les pixels non
+# nuls sont les cellules actives, les autres gardent leur valeur initiale
+# (obstacles).
+#
+#   python3 perf/make_mask.py 1000 l mask.pgm
+#   mpirun -np 4 bin/stencil_mpi 1000 -m mask.pgm
+#   bin/stencil_omp 1000 -m mask.pgm
+
+SHAPES = ["full", "l", "holes"]
+
+
+def active(shape, size, x, y):
+    if shape == "l":
+        # L : le quart haut droit est retiré
+        return not (x >= size // 2 and y < size // 2)
+    if shape == "holes":
+        # Grille de trous circulaires, un par bloc de size / 4 cellules
+        block = max(size // 4, 1)
+        cx = x % block - block // 2
+        cy = y % block - block // 2
+        return cx * cx + cy * cy > (block // 4) ** 2
+    return True
+
+
+parser = argparse.ArgumentParser(
+    description="Masque PGM de domaine irrégulier")
+parser.add_argument("size", type=int, help="taille de la grille")
+parser.add_argument("shape", choices=SHAPES, help="forme du domaine")
+parser.add_argument("output", help="fichier PGM produit")
+args = parser.parse_args()
+
+with open(args.output, "wb") as file:
+    file.write(f"P5\n{args.size} {args.size}\n255\n".encode())
+    for y in range(args.size):
+        file.write(bytes(255 if active(args.shape, args.size, x, y) else 0
+                         for x in range(args.size)))
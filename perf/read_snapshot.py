@@ -0,0 +1,87 @@
+import glob
+import struct
+import sys
+
+import numpy as np
+
+# Préfixe des fichiers de snapshots (option -o, "snapshot" par défaut)
+prefix = sys.argv[1] if len(sys.argv) > 1 else "snapshot"
+
+# En-tête d'un enregistrement : step, size_x, size_y, x0, y0, nx, ny,
+# factor, codec, chunk_rows, nchunks, quantum
+HEADER = struct.Struct("<11if")
+
+# Codecs (SNAPSHOT_CODEC_* dans src/stencil_mpi.c)
+CODEC_NONE, CODEC_LZ, CODEC_LOSSY = 0, 1, 2
+
+
+def read_length(src, i, length):
+    # Longueur étendue : octets de 255 suivis d'un octet < 255
+    if length == 15:
+        while True:
+            byte = src[i]
+            i += 1
+            length += byte
+            if byte != 255:
+                break
+    return length, i
+
+
+def lz_decompress(src):
+    # Décodage des séquences (littéraux, offset, longueur de match)
+    out = bytearray()
+    i = 0
+    while i < len(src):
+        token = src[i]
+        i += 1
+        literals, i = read_length(src, i, token >> 4)
+        out += src[i : i + literals]
+        i += literals
+        if i >= len(src):
+            break
+        offset = src[i] | (src[i + 1] << 8)
+        i += 2
+        match, i = read_length(src, i, token & 15)
+        start = len(out) - offset
+        for k in range(match + 4):
+            out.append(out[start + k])
+    return bytes(out)
+
+
+def decode_chunk(payload, codec, nx, rows, quantum):
+    # Retrouver les valeurs d'un bloc de lignes de la tuile
+    if codec == CODEC_NONE:
+        return np.frombuffer(payload, dtype=np.float32).reshape(rows, nx)
+    planes = np.frombuffer(lz_decompress(payload), dtype=np.uint8).reshape(4, -1)
+    words = planes.T.copy().view(np.uint32).reshape(rows, nx)
+    if codec == CODEC_LZ:
+        return words.view(np.float32)
+    deltas = (words >> 1).astype(np.int64) ^ -(words & 1).astype(np.int64)
+    return (np.cumsum(deltas, axis=1) * quantum).astype(np.float32)
+
+
+# Reconstruire le champ global pour chaque pas à partir des tuiles de chaque rang
+frames = {}
+for path in sorted(glob.glob(f"{prefix}_*.bin")):
+    with open(path, "rb") as file:
+        while True:
+            raw = file.read(HEADER.size)
+            if len(raw) < HEADER.size:
+                break
+            (step, size_x, size_y, x0, y0, nx, ny, factor, codec, chunk_rows,
+             nchunks, quantum) = HEADER.unpack(raw)
+            sizes = np.fromfile(file, dtype=np.uint32, count=nchunks)
+            tile = np.empty((ny, nx), dtype=np.float32)
+            for c, size in enumerate(sizes):
+                rows = min(chunk_rows, ny - c * chunk_rows)
+                tile[c * chunk_rows : c * chunk_rows + rows] = decode_chunk(
+                    file.read(int(size)), codec, nx, rows, quantum)
+            if step not in frames:
+                frames[step] = np.full((size_y, size_x), np.nan, dtype=np.float32)
+            frames[step][y0 : y0 + ny, x0 : x0 + nx] = tile
+
+# Afficher un résumé de chaque snapshot (les bords ne sont pas écrits)
+for step in sorted(frames):
+    field = frames[step]
+    print(f"step {step}: min = {np.nanmin(field):g}, max = {np.nanmax(field):g}, "
+          f"mean = {np.nanmean(field):g}")
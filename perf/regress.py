@@ -0,0 +1,175 @@
+import argparse
+import json
+import os
+import random
+import re
+import shlex
+import socket
+import statistics
+import subprocess
+import sys
+import time
+
+# Suivi des régressions de performance : exécute une suite fixe de
+# configurations, enregistre une référence (baseline) ou compare une nouvelle
+# série de mesures à la référence.
+#
+#   python3 perf/regress.py record  [--baseline perf/baseline.json]
+#   python3 perf/regress.py compare [--baseline perf/baseline.json]
+#
+# "compare" sort avec le code 1 si une configuration est significativement
+# plus lente que la référence.
+
+# Version du format du fichier de référence
+BASELINE_FORMAT = 1
+
+# Suite fixe : binaire, taille, processus MPI, threads OpenMP
+SUITE = [
+    ("stencil_seq", 50, 1, 1),
+    ("stencil_seq", 98, 1, 1),
+    ("stencil_omp", 98, 1, 2),
+    ("stencil_omp", 98, 1, 4),
+    ("stencil_mpi", 50, 4, 1),
+    ("stencil_mpi", 98, 4, 1),
+    ("stencil_hybrid", 98, 2, 2),
+    ("stencil_hybrid", 98, 4, 2),
+]
+
+# Nombre de rééchantillonnages du bootstrap et graine fixe (résultats
+# reproductibles pour les mêmes mesures)
+BOOTSTRAP = 2000
+SEED = 12345
+
+
+def config_key(binary, size, ranks, threads):
+    return f"{binary} size={size} ranks={ranks} threads={threads}"
+
+
+def run_config(args, binary, size, ranks, threads):
+    # Une exécution : temps par pas en microsecondes
+    command = [os.path.join(args.bin_dir, binary), str(size)]
+    if binary in ("stencil_mpi", "stencil_hybrid"):
+        launcher = args.launcher.format(ranks=ranks)
+        command = shlex.split(launcher) + command
+    env = dict(os.environ, OMP_NUM_THREADS=str(threads))
+    # La wisdom d'un autre réglage fausserait la comparaison
+    env["STENCIL_WISDOM"] = os.devnull
+    output = subprocess.run(command, env=env, capture_output=True, text=True,
+                            timeout=args.timeout, check=True).stdout
+    steps = re.search(r"# steps = (\d+)", output)
+    usecs = re.search(r"# time = ([\d.e+-]+) usecs", output)
+    if not steps or not usecs or int(steps.group(1)) == 0:
+        raise RuntimeError(f"sortie inattendue de {' '.join(command)}")
+    return float(usecs.group(1)) / int(steps.group(1))
+
+
+def run_suite(args):
+    # Mesures entrelacées : chaque répétition parcourt toute la suite, pour
+    # que les variations lentes de la machine touchent toutes les
+    # configurations
+    samples = {config_key(*config): [] for config in SUITE}
+    for repeat in range(args.repeat):
+        for config in SUITE:
+            key = config_key(*config)
+            usec = run_config(args, *config)
+            samples[key].append(usec)
+            print(f"[{repeat + 1}/{args.repeat}] {key}: {usec:.3f} usecs/step",
+                  file=sys.stderr)
+    return samples
+
+
+def git_commit():
+    try:
+        return subprocess.run(["git", "rev-parse", "--short", "HEAD"],
+                              capture_output=True, text=True,
+                              check=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown"
+
+
+def median_ratio_interval(base, new, level):
+    # Intervalle de confiance bootstrap du rapport des médianes new / base
+    rng = random.Random(SEED)
+    ratios = []
+    for _ in range(BOOTSTRAP):
+        b = statistics.median(rng.choices(base, k=len(base)))
+        n = statistics.median(rng.choices(new, k=len(new)))
+        ratios.append(n / b)
+    ratios.sort()
+    low = ratios[int((1 - level) / 2 * BOOTSTRAP)]
+    high = ratios[int((1 + level) / 2 * BOOTSTRAP) - 1]
+    return low, high
+
+
+def record(args):
+    baseline = {
+        "format": BASELINE_FORMAT,
+        "commit": git_commit(),
+        "host": socket.gethostname(),
+        "date": time.strftime("%Y-%m-%dT%H:%M:%S"),
+        "repeat": args.repeat,
+        "results": run_suite(args),
+    }
+    with open(args.baseline, "w") as file:
+        json.dump(baseline, file, indent=2)
+        file.write("\n")
+    print(f"baseline enregistrée dans {args.baseline} "
+          f"(commit {baseline['commit']})")
+    return 0
+
+
+def compare(args):
+    with open(args.baseline) as file:
+        baseline = json.load(file)
+    if baseline.get("format") != BASELINE_FORMAT:
+        print(f"{args.baseline} : format {baseline.get('format')} inconnu")
+        return 2
+    if baseline.get("host") != socket.gethostname():
+        print(f"attention : référence mesurée sur {baseline.get('host')}")
+    samples = run_suite(args)
+
+    # Ralentissement significatif : la borne basse de l'intervalle dépasse
+    # le seuil toléré
+    slowdowns = 0
+    print(f"référence : commit {baseline.get('commit')}, "
+          f"{baseline.get('date')}")
+    for key, new in samples.items():
+        base = baseline["results"].get(key)
+        if not base:
+            print(f"  {key}: absente de la référence")
+            continue
+        low, high = median_ratio_interval(base, new, args.level)
+        ratio = statistics.median(new) / statistics.median(base)
+        status = "ok"
+        if low > 1.0 + args.threshold:
+            status = "RALENTI"
+            slowdowns += 1
+        elif high < 1.0 - args.threshold:
+            status = "plus rapide"
+        print(f"  {key}: x{ratio:.3f} [{low:.3f}, {high:.3f}] {status}")
+    if slowdowns:
+        print(f"{slowdowns} configuration(s) significativement plus lente(s)")
+        return 1
+    return 0
+
+
+parser = argparse.ArgumentParser(
+    description="Suivi des régressions de performance des stencils")
+parser.add_argument("mode", choices=["record", "compare"])
+parser.add_argument("--baseline", default="perf/baseline.json",
+                    help="fichier de référence")
+parser.add_argument("--bin-dir", default="bin",
+                    help="répertoire des binaires")
+parser.add_argument("--launcher", default="mpirun -np {ranks}",
+                    help="lanceur MPI, {ranks} remplacé par le nombre de "
+                         "processus")
+parser.add_argument("--repeat", type=int, default=7,
+                    help="exécutions par configuration")
+parser.add_argument("--level", type=float, default=0.95,
+                    help="niveau de confiance de l'intervalle")
+parser.add_argument("--threshold", type=float, default=0.05,
+                    help="ralentissement relatif toléré")
+parser.add_argument("--timeout", type=float, default=600,
+                    help="durée maximale d'une exécution (s)")
+args = parser.parse_args()
+sys.exit(record(args) if args.mode == "record" else compare(args))
@@ -0,0 +1,133 @@
+import collections
+import ctypes
+import os
+import sys
+import weakref
+
+import numpy as np
+
+# Liaison Python du cœur du solveur (bin/libstencil.so, construit par make) :
+# le champ est exposé comme un tableau NumPy posé sur la mémoire du solveur,
+# sans copie, et les statistiques comme des valeurs structurées.
+#
+#   from stencil import Solver
+#   with Solver(1000) as solver:
+#       field = solver.field  # vue (1000, 1000) float32, mise à jour en place
+#       solver.step(100)      # pas incrémentaux
+#       solver.solve()        # jusqu'à la convergence
+#       print(solver.stats().gflops, field.mean())
+#
+# "steps" compte les pas calculés ; les binaires affichent ce nombre moins un
+# une fois la convergence atteinte.
+
+# Bibliothèque par défaut, remplacée par $STENCIL_LIB
+LIBRARY = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "bin",
+                       "libstencil.so")
+
+Stats = collections.namedtuple(
+    "Stats", ["size_x", "size_y", "steps", "converged", "time_usec", "gflops"])
+
+
+class _Stats(ctypes.Structure):
+    # Même disposition que stencil_stats_t (src/stencil_lib.h)
+    _fields_ = [
+        ("size_x", ctypes.c_int),
+        ("size_y", ctypes.c_int),
+        ("steps", ctypes.c_int),
+        ("converged", ctypes.c_int),
+        ("time_usec", ctypes.c_double),
+        ("gflops", ctypes.c_double),
+    ]
+
+
+def _load(path):
+    lib = ctypes.CDLL(path)
+    lib.stencil_solver_create.argtypes = [ctypes.c_int]
+    lib.stencil_solver_create.restype = ctypes.c_void_p
+    lib.stencil_solver_destroy.argtypes = [ctypes.c_void_p]
+    lib.stencil_solver_destroy.restype = None
+    lib.stencil_solver_step.argtypes = [ctypes.c_void_p, ctypes.c_int]
+    lib.stencil_solver_step.restype = ctypes.c_int
+    lib.stencil_solver_solve.argtypes = [ctypes.c_void_p]
+    lib.stencil_solver_solve.restype = ctypes.c_int
+    lib.stencil_solver_field.argtypes = [ctypes.c_void_p]
+    lib.stencil_solver_field.restype = ctypes.POINTER(ctypes.c_float)
+    lib.stencil_solver_stats.argtypes = [ctypes.c_void_p,
+                                         ctypes.POINTER(_Stats)]
+    lib.stencil_solver_stats.restype = None
+    lib.stencil_solver_stencil.argtypes = []
+    lib.stencil_solver_stencil.restype = ctypes.c_char_p
+    return lib
+
+
+class Solver:
+    def __init__(self, size, library=None):
+        path = library or os.environ.get("STENCIL_LIB", LIBRARY)
+        self._lib = _load(path)
+        self._handle = self._lib.stencil_solver_create(size)
+        if not self._handle:
+            raise ValueError(f"taille de grille invalide : {size}")
+        stats = self.stats()
+        # Vue sans copie : le solveur met à jour le champ en place. La
+        # mémoire appartient au tableau ctypes sous la vue : le solveur C
+        # n'est détruit qu'avec ce tableau, une fois close() appelé et la
+        # dernière vue libérée. Une vue reste donc lisible après close().
+        cells = stats.size_x * stats.size_y
+        pointer = self._lib.stencil_solver_field(self._handle)
+        buffer = (ctypes.c_float * cells).from_address(
+            ctypes.addressof(pointer.contents))
+        weakref.finalize(buffer, self._lib.stencil_solver_destroy,
+                         self._handle)
+        self.field = np.frombuffer(buffer, dtype=np.float32).reshape(
+            stats.size_y, stats.size_x)
+
+    @property
+    def stencil(self):
+        return self._lib.stencil_solver_stencil().decode()
+
+    def step(self, steps=1):
+        # Renvoie le nombre de pas effectués, moins que demandé si le champ
+        # converge
+        self._check()
+        return self._lib.stencil_solver_step(self._handle, steps)
+
+    def solve(self):
+        self._check()
+        return self._lib.stencil_solver_solve(self._handle)
+
+    def stats(self):
+        self._check()
+        stats = _Stats()
+        self._lib.stencil_solver_stats(self._handle, ctypes.byref(stats))
+        return Stats(stats.size_x, stats.size_y, stats.steps,
+                     bool(stats.converged), stats.time_usec, stats.gflops)
+
+    def close(self):
+        # Plus de pas après close() ; la mémoire est libérée avec la dernière
+        # vue du champ
+        self._handle = None
+        self.field = None
+
+    def _check(self):
+        if not self._handle:
+            raise RuntimeError("solveur fermé")
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+
+if __name__ == "__main__":
+    # Résolution complète d'une grille : python3 perf/stencil.py [taille]
+    size = int(sys.argv[1]) if len(sys.argv) > 1 else 10
+    with Solver(size) as solver:
+        solver.solve()
+        stats = solver.stats()
+        print(f"# size = {size}")
+        print(f"# stencil = {solver.stencil}")
+        print(f"# steps = {stats.steps}")
+        print(f"# time = {stats.time_usec:g} usecs.")
+        print(f"# gflops = {stats.gflops:g}")
+        print(f"# mean = {solver.field.mean():g}")
@@ -0,0 +1,23 @@
+import socket
+import sys
+
+# Client du mode serveur (option -S) : envoie une série de tailles de grille
+# au serveur et affiche les réponses
+# Usage : python3 submit_jobs.py <socket> <taille> [<taille> ...] [--quit]
+path = sys.argv[1]
+sizes = [int(arg) for arg in sys.argv[2:] if arg != "--quit"]
+quit_server = "--quit" in sys.argv[2:]
+
+with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+    sock.connect(path)
+    replies = sock.makefile("r")
+    requests = [f"solve {size}" for size in sizes]
+    if quit_server:
+        requests.append("quit")
+    for request in requests:
+        sock.sendall((request + "\n").encode())
+        # Une réponse se termine par la ligne "end"
+        for line in replies:
+            if line.strip() == "end":
+                break
+            print(line, end="")
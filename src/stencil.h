@@ -0,0 +1,104 @@
+#ifndef STENCIL_H
+#define STENCIL_H
+
+/* Compile-time description of the stencil shared by all the versions.
+ *
+ * A stencil is the discrete Laplacian used in the update
+ *   next = alpha * sum(weight * neighbour) + (1 + alpha * center) * value
+ * listed as STENCIL_TAPS(T, c, sx), which expands T(c, sx, dx, dy, weight)
+ * for each neighbour at offset (dx, dy) of the cell pointed to by c in a
+ * field of row stride sx. Kernels are generated by expanding the list, so
+ * every update is a fixed sum of constant weights that the compiler
+ * unrolls and vectorizes along x. The radius is the width of the fixed
+ * border and of the halo exchanged between ranks.
+ *
+ * Select one with -DSTENCIL=STENCIL_<NAME> (make STENCIL=<NAME>). */
+
+#define STENCIL_STAR5 1  // 2nd order 5-point star
+#define STENCIL_BOX9 2   // 9-point box, isotropic error
+#define STENCIL_STAR9 3  // 4th order 9-point star
+#define STENCIL_ANISO5 4 // 5-point star, conduction 3 times faster along x
+
+#ifndef STENCIL
+#define STENCIL STENCIL_STAR5
+#endif
+
+/** type of the field values */
+typedef float stencil_t;
+
+#if STENCIL == STENCIL_STAR5
+#define STENCIL_NAME "star5"
+#define STENCIL_RADIUS 1
+#define STENCIL_CENTER (-4.0)
+#define STENCIL_FLOPS 6 // per cell update, symmetric weights factored
+#define STENCIL_TAPS(T, c, sx)                                                 \
+  T(c, sx, -1, 0, 1.0)                                                         \
+  T(c, sx, 1, 0, 1.0)                                                          \
+  T(c, sx, 0, -1, 1.0)                                                         \
+  T(c, sx, 0, 1, 1.0)
+
+#elif STENCIL == STENCIL_BOX9
+#define STENCIL_NAME "box9"
+#define STENCIL_RADIUS 1
+#define STENCIL_CENTER (-20.0 / 6.0)
+#define STENCIL_FLOPS 12
+#define STENCIL_TAPS(T, c, sx)                                                 \
+  T(c, sx, -1, 0, 4.0 / 6.0)                                                   \
+  T(c, sx, 1, 0, 4.0 / 6.0)                                                    \
+  T(c, sx, 0, -1, 4.0 / 6.0)                                                   \
+  T(c, sx, 0, 1, 4.0 / 6.0)                                                    \
+  T(c, sx, -1, -1, 1.0 / 6.0)                                                  \
+  T(c, sx, 1, -1, 1.0 / 6.0)                                                   \
+  T(c, sx, -1, 1, 1.0 / 6.0)                                                   \
+  T(c, sx, 1, 1, 1.0 / 6.0)
+
+#elif STENCIL == STENCIL_STAR9
+#define STENCIL_NAME "star9"
+#define STENCIL_RADIUS 2
+#define STENCIL_CENTER (-5.0)
+#define STENCIL_FLOPS 12
+#define STENCIL_TAPS(T, c, sx)                                                 \
+  T(c, sx, -1, 0, 4.0 / 3.0)                                                   \
+  T(c, sx, 1, 0, 4.0 / 3.0)                                                    \
+  T(c, sx, 0, -1, 4.0 / 3.0)                                                   \
+  T(c, sx, 0, 1, 4.0 / 3.0)                                                    \
+  T(c, sx, -2, 0, -1.0 / 12.0)                                                 \
+  T(c, sx, 2, 0, -1.0 / 12.0)                                                  \
+  T(c, sx, 0, -2, -1.0 / 12.0)                                                 \
+  T(c, sx, 0, 2, -1.0 / 12.0)
+
+#elif STENCIL == STENCIL_ANISO5
+#define STENCIL_NAME "aniso5"
+#define STENCIL_RADIUS 1
+#define STENCIL_CENTER (-4.0)
+#define STENCIL_FLOPS 8
+#define STENCIL_TAPS(T, c, sx)                                                 \
+  T(c, sx, -1, 0, 1.5)                                                         \
+  T(c, sx, 1, 0, 1.5)                                                          \
+  T(c, sx, 0, -1, 0.5)                                                         \
+  T(c, sx, 0, 1, 0.5)
+
+#else
+#error "unknown STENCIL"
+#endif
+
+/** one weighted neighbour of the cell pointed to by c */
+#define STENCIL_TERM(c, sx, dx, dy, w)                                         \
+  +(stencil_t)(w) * (c)[(dx) + (dy) * (sx)]
+
+/** next value of the cell pointed to by c in a field of row stride sx */
+#define STENCIL_APPLY(c, sx, alpha)                                            \
+  ((alpha) * (STENCIL_TAPS(STENCIL_TERM, c, sx)) +                             \
+   (1.0 + STENCIL_CENTER * (alpha)) * (c)[0])
+
+/** one weighted neighbour in the symbol of the update, t holding the angular
+ * frequencies along x and y */
+#define STENCIL_SYMBOL_TERM(t, sx, dx, dy, w)                                  \
+  +(w) * cos((dx) * (t)[0]) * cos((dy) * (t)[1])
+
+/** eigenvalue of the update for the Fourier mode of angular frequencies t,
+ * the weights being symmetric */
+#define STENCIL_SYMBOL(t, alpha)                                               \
+  (1.0 + (alpha) * (STENCIL_CENTER STENCIL_TAPS(STENCIL_SYMBOL_TERM, t, 0)))
+
+#endif
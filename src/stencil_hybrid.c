@@ -1,4 +1,6 @@
+#include <float.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,9 +8,13 @@
 
 #include <mpi.h>
 #include <omp.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
-typedef float stencil_t;
+#include "stencil.h"
+#include "stencil_inplace.h"
 
 /** conduction coeff used in computation */
 static const stencil_t alpha = 0.02;
@@ -19,44 +25,616 @@ static const stencil_t epsilon = 0.0001;
 /** max number of steps */
 static const int stencil_max_steps = 100000;
 
+/** number of steps timed for each autotuning candidate */
+static const int autotune_steps = 100;
+
+/** tile shapes tried by the autotuner, clamped to the local tile */
+static const int autotune_tiles[][2] = {
+    {1 << 30, 8}, {512, 16}, {256, 16}, {128, 32}, {64, 64}};
+static const int autotune_tile_count =
+    sizeof(autotune_tiles) / sizeof(autotune_tiles[0]);
+
 // ONLY RANK 0
-static int test_mode = 0;
 static stencil_t *values = NULL;
-static stencil_t *prev_values = NULL;
 static int size_x; // global size borders
 static int size_y; // global size borders
 
 // ALL RANKS
+static int test_mode = 0;                   // verify against the reference
 static int rank;                            // MPI rank
 static int size;                            // MPI size
 static int local_size_x;                    // local size without halo
 static int local_size_y;                    // local size without halo
+static int local_x0, local_y0; // interior offset of the local tile
 static stencil_t *local_values = NULL;      // local values with halo
 static stencil_t *local_prev_values = NULL; // local prev_values with halo
 
 static int grid_dim[2];                               // grid dimensions
+static int node_dim[2] = {0, 0}; // grid of node blocks, 0 = flat placement
 static int grid_coord[2];                             // grid coordinates
 static int rank_up, rank_down, rank_left, rank_right; // neighbors
 static MPI_Comm comm2d; // 2D communicator for Cartesian topology
 
+// ADI TIME STEPPING (ALL RANKS)
+static double adi_factor = 0.0; // ADI step in explicit steps, 0 = explicit
+#define ADI_LINE_BLOCK 64       // lines solved together by a thread
+
+/** transposition plan of one ADI sweep within a row or column of ranks */
+typedef struct {
+  MPI_Comm comm;      // ranks sharing the lines of this sweep
+  int ranks, me;      // size of comm and rank in comm
+  int n;              // global line length
+  int lines;          // lines crossing the local tile
+  int *owner, *slot;  // rank solving each line and its index there
+  int *line_count;    // lines solved by each rank
+  int *send_counts, *send_displs, *recv_counts, *recv_displs;
+  stencil_t *cp, *inv; // Thomas coefficients
+} adi_sweep_t;
+
+static adi_sweep_t adi_sweep_x, adi_sweep_y;
+static stencil_t *adi_send = NULL; // local cells of the lines, per owner
+static stencil_t *adi_recv = NULL; // whole lines solved locally
+
+static int tuned_dim[2] = {0, 0}; // grid dimensions from wisdom, 0 = free
+static int tuned_threads = 0;      // OpenMP threads from wisdom, 0 = free
+static int autotune_mode = 0;     // run the trials and store the wisdom
+
+// WARM START (ALL RANKS)
+static char warm_read_prefix[256] = "";  // tiles to start from, "" = cold
+static char warm_write_prefix[256] = ""; // tiles to save the result to
+static int boundary_set[4] = {0, 0, 0, 0}; // overridden sides: up, down,
+static stencil_t boundary_value[4];        // left, right and their values
+
+/** header of a saved tile, which must match the decomposition to load it */
+typedef struct {
+  int32_t size_x, size_y; // global size with borders
+  int32_t radius;         // STENCIL_RADIUS
+  int32_t dim[2];         // grid dimensions
+  int32_t coord[2];       // grid coordinates of the tile
+} warm_header_t;
+
+// PARAREAL (ALL RANKS)
+static int parareal_slices = 0;    // time slices run in parallel, 0 = off
+static int parareal_steps = 10000; // fine steps over all the slices
+static int parareal_coarse = 4;    // coarse ADI steps per slice
+static const double parareal_tolerance = 0.0001; // converged correction
+
+// IN-PLACE JACOBI (ALL RANKS)
+static int inplace_mode = 0; // single local field, no local_prev_values
+static stencil_t *inplace_rows = NULL;    // old rows around each tile band
+static stencil_t *inplace_cols = NULL;    // old columns around each tile column
+static stencil_t *inplace_windows = NULL; // rolling windows of old rows
+static int inplace_window_cells = 0;      // window size of one thread
+static size_t inplace_reserved[3] = {0, 0, 0}; // allocated strips, windows
+
+// CHEBYSHEV ACCELERATION (ALL RANKS)
+/** Chebyshev acceleration (-k): x' = x + w[0] (x - x_prev) + w[1] (J(x) - x),
+ * J being the Jacobi update, with weights from bounds of its spectrum */
+static int chebyshev_mode = 0;
+#define CHEBYSHEV_SAMPLES 32       // modes sampled along each axis
+static double chebyshev_bounds[2]; // min and max eigenvalues of J
+static double chebyshev_rho;       // of the previous step, 0 before the first
+static stencil_t chebyshev_w[2];   // weights of the current step
+
+// EVENT TRACE (ALL RANKS)
+static char trace_path[256] = ""; // Chrome trace JSON output, "" = off
+#define TRACE_RING_EVENTS 65536   // events kept per thread, oldest dropped
+
+#define TRACE_COMPUTE 0    // local update of a step
+#define TRACE_HALO_LEFT 1  // halo sendrecv to the left neighbour
+#define TRACE_HALO_RIGHT 2 // halo sendrecv to the right neighbour
+#define TRACE_HALO_UP 3    // halo sendrecv to the upper neighbour
+#define TRACE_HALO_DOWN 4  // halo sendrecv to the lower neighbour
+#define TRACE_ALLREDUCE 5  // convergence reduction of a step
+#define TRACE_SCATTER 6    // distribution of the initial tiles
+#define TRACE_GATHER 7     // gathering of the result on rank 0
+static const char *trace_names[] = {
+    "compute",   "halo left", "halo right", "halo up",
+    "halo down", "allreduce", "scatter",    "gather"};
+
+/** one complete event, times in usecs since the common origin */
+typedef struct {
+  int32_t thread, name;
+  double begin, end;
+} trace_event_t;
+
+/** events of one thread in a ring overwriting the oldest ones */
+typedef struct {
+  trace_event_t *events;
+  long count; // events recorded, wrapped modulo TRACE_RING_EVENTS
+} __attribute__((aligned(64))) trace_ring_t;
+
+static trace_ring_t *trace_rings = NULL; // NULL = not recording
+static int trace_ring_count = 0;
+static struct timespec trace_origin; // taken by all ranks after a barrier
+
+// MASKED DOMAIN (ALL RANKS)
+static char mask_path[256] = ""; // PGM geometry mask, "" = full rectangle
+static uint8_t *mask = NULL;     // ONLY RANK 0: nonzero for active cells
+
+/** active cells of the local tile as runs of contiguous columns: the runs of
+ * interior row y are row_runs[y - STENCIL_RADIUS] to row_runs[y -
+ * STENCIL_RADIUS + 1], run i covers columns runs[2 * i] to runs[2 * i + 1]
+ * (halo coordinates). Without a mask, every row is a single run. */
+static int *row_runs = NULL;
+static int *runs = NULL;
+static long active_cells = 0; // in the local tile
+
+// JOB SERVER (ALL RANKS)
+static char server_path[108] = ""; // Unix socket of the job server, "" = off
+
 static MPI_Datatype halo_column; // halo column datatype
 static MPI_Datatype halo_row;    // halo row datatype
 
-#define IND(x, y)                                                              \
-  ((x) + (local_size_x + 2) * (y)) // 2D indexing macro with halo
+// HALO CODEC (ALL RANKS)
+static int halo_codec = 0; // HALO_CODEC_* applied to the halo messages
+
+#define HALO_CODEC_NONE 0 // raw floats through the halo datatypes
+#define HALO_CODEC_FP16 1 // deltas as fp16 with a power of two scale
+#define HALO_CODEC_BF16 2 // deltas as bf16
+
+#define HALO_RAW 0x8000 // message header: raw floats follow, not codes
+static const double halo_codec_tolerance = 1e-6; // max coded halo error
+
+/** the cells sent to each neighbour (left, right, up, down) are coded as
+ * deltas against the values the neighbour has reconstructed so far, kept
+ * on both sides, so that the coding errors do not accumulate */
+static stencil_t *halo_ref_send[4];
+static stencil_t *halo_ref_recv[4];
+static uint16_t *halo_send_buf = NULL; // header and codes, or raw floats
+static uint16_t *halo_recv_buf = NULL;
+static double halo_coded_messages = 0.0; // messages sent as codes
+static double halo_raw_messages = 0.0;   // messages sent as raw floats
+static double halo_sent_bytes = 0.0;     // bytes sent
+static double halo_float_bytes = 0.0;    // bytes of the same cells as floats
+
+// SNAPSHOT OUTPUT (ALL RANKS)
+static int snapshot_every = 0;        // snapshot period in steps, 0 = off
+static char snapshot_prefix[256] = "snapshot"; // output file prefix
+static int snapshot_factor = 1;       // keep one cell out of factor per axis
+static int snapshot_codec = 0;        // SNAPSHOT_CODEC_* applied to each chunk
+
+#define SNAPSHOT_CODEC_NONE 0  // raw floats
+#define SNAPSHOT_CODEC_LZ 1    // byte shuffle + LZ, lossless
+#define SNAPSHOT_CODEC_LOSSY 2 // quantized to epsilon, delta + shuffle + LZ
+
+#define SNAPSHOT_CHUNK_CELLS 16384 // target cells per compression chunk
+
+/** one staging buffer of the double-buffered snapshot pipeline */
+typedef struct {
+  stencil_t *data;      // downsampled copy of the local tile without halo
+  uint8_t *scratch;     // shuffled bytes, one region per chunk
+  uint8_t *payload;     // compressed bytes, one region per chunk
+  uint32_t *chunk_size; // compressed size of each chunk
+  int step;             // step the copy was taken at
+  int full;             // 1 while the writer owns the buffer
+} snapshot_slot_t;
+
+/** record header written before every tile in a snapshot file */
+typedef struct {
+  int32_t step;           // step the tile was taken at
+  int32_t size_x, size_y; // downsampled global size with borders
+  int32_t x0, y0;         // tile origin in the downsampled grid
+  int32_t nx, ny;         // downsampled tile size
+  int32_t factor;         // downsampling factor
+  int32_t codec;          // SNAPSHOT_CODEC_*
+  int32_t chunk_rows;     // tile rows per chunk
+  int32_t nchunks;        // number of chunk sizes following the header
+  float quantum;          // quantization step of SNAPSHOT_CODEC_LOSSY
+} snapshot_header_t;
+
+static snapshot_slot_t snapshot_slots[2];
+static int snapshot_x0, snapshot_y0; // first sampled cell of the local tile
+static int snapshot_nx, snapshot_ny; // downsampled local tile size
+static int snapshot_chunk_rows;      // tile rows per compression chunk
+static int snapshot_nchunks;         // compression chunks per snapshot
+static size_t snapshot_chunk_bound;  // max compressed bytes of one chunk
+static int snapshot_next = 0; // next slot to fill
+static int snapshot_done = 0; // set when no more snapshots will come
+static int snapshot_count = 0;
+static FILE *snapshot_file = NULL;
+static pthread_t snapshot_thread;
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t snapshot_cond = PTHREAD_COND_INITIALIZER;
+static double snapshot_copy_usec = 0.0;     // time spent copying to staging
+static double snapshot_compress_usec = 0.0; // writer time compressing
+static double snapshot_wait_usec = 0.0;     // time spent waiting for a slot
+static double snapshot_write_usec = 0.0;    // writer time writing
+static double snapshot_raw_bytes = 0.0;     // bytes before compression
+static double snapshot_out_bytes = 0.0;     // bytes written to the file
+
+#define LOCAL_STRIDE (local_size_x + 2 * STENCIL_RADIUS) // row stride with halo
+#define LOCAL_CELLS (LOCAL_STRIDE * (local_size_y + 2 * STENCIL_RADIUS))
+#define IND(x, y) ((x) + LOCAL_STRIDE * (y)) // 2D indexing macro with halo
+
+/** per-thread deque of the tile scheduler: the owner pops tiles from head,
+ * thieves steal from tail, both under the lock */
+typedef struct {
+  int head, tail;
+  omp_lock_t lock;
+} __attribute__((aligned(64))) tile_deque_t;
+
+static int tile_x = 256; // tile width in cells
+static int tile_y = 16;  // tile height in rows
+static int tile_set = 0; // 1 if -b gave the tile, which wisdom then keeps
+static int tile_count_x, tile_count_y;
+static tile_deque_t *tile_deques = NULL;
+static int tile_deque_count = 0;
+
+/** size the tile grid and the deques for the current thread count */
+static void tile_setup(int nx, int ny) {
+  if (tile_x < 1 || tile_x > nx) {
+    tile_x = nx;
+  }
+  if (tile_y < 1 || tile_y > ny) {
+    tile_y = ny;
+  }
+  tile_count_x = (nx + tile_x - 1) / tile_x;
+  tile_count_y = (ny + tile_y - 1) / tile_y;
+  int threads = omp_get_max_threads();
+  if (threads > tile_deque_count) {
+    for (int t = 0; t < tile_deque_count; t++) {
+      omp_destroy_lock(&tile_deques[t].lock);
+    }
+    free(tile_deques);
+    tile_deques = aligned_alloc(64, threads * sizeof(tile_deque_t));
+    for (int t = 0; t < threads; t++) {
+      omp_init_lock(&tile_deques[t].lock);
+    }
+    tile_deque_count = threads;
+  }
+}
+
+static void tile_release(void) {
+  for (int t = 0; t < tile_deque_count; t++) {
+    omp_destroy_lock(&tile_deques[t].lock);
+  }
+  free(tile_deques);
+  tile_deques = NULL;
+  tile_deque_count = 0;
+}
+
+/** fill the calling thread's deque with its contiguous share of the tiles,
+ * the same share every step so that tiles stay on the thread that touched
+ * them first */
+static void tile_deque_reset(void) {
+  int t = omp_get_thread_num();
+  int threads = omp_get_num_threads();
+  int count = tile_count_x * tile_count_y;
+  omp_set_lock(&tile_deques[t].lock);
+  tile_deques[t].head = (long)count * t / threads;
+  tile_deques[t].tail = (long)count * (t + 1) / threads;
+  omp_unset_lock(&tile_deques[t].lock);
+}
+
+/** next tile for the calling thread: its own first, then stolen from the
+ * other deques, -1 when every deque is empty */
+static int tile_next(void) {
+  int t = omp_get_thread_num();
+  int threads = omp_get_num_threads();
+  int tile = -1;
+  omp_set_lock(&tile_deques[t].lock);
+  if (tile_deques[t].head < tile_deques[t].tail) {
+    tile = tile_deques[t].head++;
+  }
+  omp_unset_lock(&tile_deques[t].lock);
+  for (int i = 1; tile < 0 && i < threads; i++) {
+    tile_deque_t *victim = &tile_deques[(t + i) % threads];
+    omp_set_lock(&victim->lock);
+    if (victim->head < victim->tail) {
+      tile = --victim->tail;
+    }
+    omp_unset_lock(&victim->lock);
+  }
+  return tile;
+}
+
+/** zero the interior tile by tile with the scheduler's initial thread
+ * assignment, so that pages are first touched by the thread using them */
+static void tile_first_touch(stencil_t *buf) {
+#pragma omp parallel
+  {
+    int threads = omp_get_num_threads();
+    int count = tile_count_x * tile_count_y;
+    int t = omp_get_thread_num();
+    for (int tile = (long)count * t / threads;
+         tile < (long)count * (t + 1) / threads; tile++) {
+      int x0 = STENCIL_RADIUS + (tile % tile_count_x) * tile_x;
+      int y0 = STENCIL_RADIUS + (tile / tile_count_x) * tile_y;
+      int x1 = x0 + tile_x < local_size_x + STENCIL_RADIUS
+                   ? x0 + tile_x
+                   : local_size_x + STENCIL_RADIUS;
+      int y1 = y0 + tile_y < local_size_y + STENCIL_RADIUS
+                   ? y0 + tile_y
+                   : local_size_y + STENCIL_RADIUS;
+      for (int y = y0; y < y1; y++) {
+        memset(&buf[IND(x0, y)], 0, (x1 - x0) * sizeof(stencil_t));
+      }
+    }
+  }
+  // halo ring
+  memset(&buf[IND(0, 0)], 0,
+         STENCIL_RADIUS * LOCAL_STRIDE * sizeof(stencil_t));
+  memset(&buf[IND(0, local_size_y + STENCIL_RADIUS)], 0,
+         STENCIL_RADIUS * LOCAL_STRIDE * sizeof(stencil_t));
+  for (int y = STENCIL_RADIUS; y < local_size_y + STENCIL_RADIUS; y++) {
+    memset(&buf[IND(0, y)], 0, STENCIL_RADIUS * sizeof(stencil_t));
+    memset(&buf[IND(local_size_x + STENCIL_RADIUS, y)], 0,
+           STENCIL_RADIUS * sizeof(stencil_t));
+  }
+}
+
+static double elapsed_usec(const struct timespec *t1,
+                           const struct timespec *t2) {
+  return (t2->tv_sec - t1->tv_sec) * 1000000.0 +
+         (t2->tv_nsec - t1->tv_nsec) / 1000.0;
+}
+
+/** usecs since the trace origin, 0 when not recording */
+static double trace_now() {
+  if (trace_rings == NULL) {
+    return 0.0;
+  }
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return elapsed_usec(&trace_origin, &t);
+}
+
+/** record the event name of the calling thread, from begin to now */
+static void trace_record(int name, double begin) {
+  int thread = omp_get_thread_num();
+  if (trace_rings == NULL || thread >= trace_ring_count) {
+    return;
+  }
+  trace_ring_t *ring = &trace_rings[thread];
+  trace_event_t *event = &ring->events[ring->count++ % TRACE_RING_EVENTS];
+  event->thread = thread;
+  event->name = name;
+  event->begin = begin;
+  event->end = trace_now();
+}
+
+/** preallocate one ring per OpenMP thread and take the origin once every
+ * rank is there */
+static void trace_start() {
+  if (trace_path[0] == '\0') {
+    return;
+  }
+  trace_ring_count = omp_get_max_threads();
+  trace_rings = aligned_alloc(64, trace_ring_count * sizeof(trace_ring_t));
+  for (int t = 0; t < trace_ring_count; t++) {
+    trace_rings[t].events = malloc(TRACE_RING_EVENTS * sizeof(trace_event_t));
+    memset(trace_rings[t].events, 0,
+           TRACE_RING_EVENTS * sizeof(trace_event_t));
+    trace_rings[t].count = 0;
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+  clock_gettime(CLOCK_MONOTONIC, &trace_origin);
+}
+
+/** stop recording, gather the events of every rank on rank 0 and write them
+ * in the Chrome trace format, one process per rank */
+static void trace_finish() {
+  if (trace_rings == NULL) {
+    return;
+  }
+  long kept = 0, dropped = 0;
+  for (int t = 0; t < trace_ring_count; t++) {
+    long count = trace_rings[t].count;
+    kept += count < TRACE_RING_EVENTS ? count : TRACE_RING_EVENTS;
+    dropped += count < TRACE_RING_EVENTS ? 0 : count - TRACE_RING_EVENTS;
+  }
+  trace_event_t *events = malloc((kept > 0 ? kept : 1) * sizeof(trace_event_t));
+  long n = 0;
+  for (int t = 0; t < trace_ring_count; t++) {
+    long count = trace_rings[t].count;
+    long first = count < TRACE_RING_EVENTS ? 0 : count - TRACE_RING_EVENTS;
+    for (long i = first; i < count; i++) {
+      events[n++] = trace_rings[t].events[i % TRACE_RING_EVENTS];
+    }
+    free(trace_rings[t].events);
+  }
+  free(trace_rings);
+  trace_rings = NULL;
+
+  // under Parareal, rank is the one in the time slice: gather by world rank
+  int world_rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  long counts[2] = {kept, dropped};
+  if (world_rank != 0) {
+    MPI_Send(counts, 2, MPI_LONG, 0, 0, MPI_COMM_WORLD);
+    MPI_Send(events, kept * sizeof(trace_event_t), MPI_BYTE, 0, 0,
+             MPI_COMM_WORLD);
+    free(events);
+    return;
+  }
+  FILE *out = fopen(trace_path, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Cannot write trace file %s\n", trace_path);
+  } else {
+    fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  }
+  long total[2] = {0, 0};
+  for (int r = 0; r < size; r++) {
+    trace_event_t *rank_events = events;
+    if (r != 0) {
+      MPI_Recv(counts, 2, MPI_LONG, r, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+      rank_events = malloc((counts[0] > 0 ? counts[0] : 1) *
+                           sizeof(trace_event_t));
+      MPI_Recv(rank_events, counts[0] * sizeof(trace_event_t), MPI_BYTE, r, 0,
+               MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    }
+    if (out != NULL) {
+      fprintf(out,
+              "%s{\"name\": \"process_name\", \"ph\": \"M\", "
+              "\"pid\": %d, \"args\": {\"name\": \"rank %d\"}}",
+              r == 0 ? "" : ",\n", r, r);
+      for (long i = 0; i < counts[0]; i++) {
+        const trace_event_t *e = &rank_events[i];
+        fprintf(out,
+                ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, "
+                "\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                trace_names[e->name], r, e->thread, e->begin,
+                e->end - e->begin);
+      }
+    }
+    total[0] += counts[0];
+    total[1] += counts[1];
+    if (r != 0) {
+      free(rank_events);
+    }
+  }
+  if (out != NULL) {
+    fprintf(out, "\n]}\n");
+    fclose(out);
+    printf("# trace = %s, %ld events, %ld dropped\n", trace_path, total[0],
+           total[1]);
+  }
+  free(events);
+}
 
 static void setup_process() {
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
   MPI_Comm_size(MPI_COMM_WORLD, &size);
 }
 
-static void setup_2D_topology() {
-  // Compute the grid dimensions
-  grid_dim[0] = grid_dim[1] = 0;
-  MPI_Dims_create(size, 2, grid_dim);
+/** split comm into shared-memory domains of the given type; return the
+ * caller's domain communicator, the domain index and the domain count, or
+ * MPI_COMM_NULL if some rank could not be placed in a domain */
+static MPI_Comm split_domain(MPI_Comm comm, int split_type, int *index,
+                             int *count) {
+  int comm_rank;
+  MPI_Comm_rank(comm, &comm_rank);
+  MPI_Comm domain;
+  MPI_Comm_split_type(comm, split_type, comm_rank, MPI_INFO_NULL, &domain);
+  int placed = domain != MPI_COMM_NULL;
+  int all_placed;
+  MPI_Allreduce(&placed, &all_placed, 1, MPI_INT, MPI_LAND, comm);
+  if (!all_placed) {
+    if (placed) {
+      MPI_Comm_free(&domain);
+    }
+    return MPI_COMM_NULL;
+  }
+
+  // domains are numbered by the rank of their first member
+  int domain_rank;
+  MPI_Comm_rank(domain, &domain_rank);
+  MPI_Comm leaders;
+  MPI_Comm_split(comm, domain_rank == 0 ? 0 : MPI_UNDEFINED, comm_rank,
+                 &leaders);
+  int info[2] = {0, 0};
+  if (domain_rank == 0) {
+    MPI_Comm_rank(leaders, &info[0]);
+    MPI_Comm_size(leaders, &info[1]);
+    MPI_Comm_free(&leaders);
+  }
+  MPI_Bcast(info, 2, MPI_INT, 0, domain);
+  *index = info[0];
+  *count = info[1];
+  return domain;
+}
+
+/** position of the caller in the grid when nodes (and NUMA domains when
+ * the MPI library exposes them) get contiguous blocks of the domain, or
+ * the world rank when ranks are not spread evenly over the domains */
+static int hierarchical_rank() {
+  int world_rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+
+  // index and count of the caller at each level: node, NUMA, rank
+  int index[3], count[3], levels = 0;
+  MPI_Comm node = split_domain(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED,
+                               &index[levels], &count[levels]);
+  if (node == MPI_COMM_NULL) {
+    return world_rank;
+  }
+  levels++;
+  MPI_Comm last = node;
+#if defined(OPEN_MPI)
+  MPI_Comm numa =
+      split_domain(node, OMPI_COMM_TYPE_NUMA, &index[levels], &count[levels]);
+  if (numa != MPI_COMM_NULL) {
+    levels++;
+    last = numa;
+  }
+#endif
+  MPI_Comm_rank(last, &index[levels]);
+  MPI_Comm_size(last, &count[levels]);
+  levels++;
+  if (last != node) {
+    MPI_Comm_free(&last);
+  }
+  MPI_Comm_free(&node);
+
+  // every node must hold the same layout
+  int min_count[3], max_count[3];
+  MPI_Allreduce(count, min_count, levels, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  MPI_Allreduce(count, max_count, levels, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+  if (memcmp(min_count, max_count, levels * sizeof(int)) != 0) {
+    return world_rank;
+  }
+
+  // split the remaining grid level by level, cutting the fewest halo cells
+  // at the outermost levels first
+  int rest[2] = {grid_dim[0], grid_dim[1]};
+  int coord[2] = {0, 0};
+  for (int l = 0; l < levels; l++) {
+    int best_a = 0;
+    long best_cut = 0;
+    for (int a = 1; a <= count[l]; a++) {
+      int b = count[l] / a;
+      if (a * b != count[l] || rest[0] % a != 0 || rest[1] % b != 0) {
+        continue;
+      }
+      long cut = (long)(a - 1) * (size_y - 2 * STENCIL_RADIUS) +
+                 (long)(b - 1) * (size_x - 2 * STENCIL_RADIUS);
+      if (best_a == 0 || cut < best_cut) {
+        best_a = a;
+        best_cut = cut;
+      }
+    }
+    if (best_a == 0) {
+      return world_rank;
+    }
+    int best_b = count[l] / best_a;
+    rest[0] /= best_a;
+    rest[1] /= best_b;
+    coord[0] = coord[0] * best_a + index[l] / best_b;
+    coord[1] = coord[1] * best_b + index[l] % best_b;
+    if (l == 0) {
+      node_dim[0] = best_a;
+      node_dim[1] = best_b;
+    }
+  }
+  return coord[0] * grid_dim[1] + coord[1];
+}
+
+/** set up the grid over the ranks of parent: MPI_COMM_WORLD, or the ranks of
+ * one time slice in Parareal mode */
+static void setup_2D_topology(MPI_Comm parent) {
+  // Compute the grid dimensions, keeping the tuned ones if any
+  int parent_size;
+  MPI_Comm_size(parent, &parent_size);
+  grid_dim[0] = tuned_dim[0];
+  grid_dim[1] = tuned_dim[1];
+  MPI_Dims_create(parent_size, 2, grid_dim);
 
-  // Create the 2D Cartesian communicator
-  MPI_Cart_create(MPI_COMM_WORLD, 2, grid_dim, (int[]){0, 0}, 0, &comm2d);
+  // Create the 2D Cartesian communicator with ranks ordered by their place
+  // in the node hierarchy when the grid spans the world; rank 0 of parent
+  // always stays rank 0
+  node_dim[0] = node_dim[1] = 0;
+  int key;
+  if (parent == MPI_COMM_WORLD) {
+    key = hierarchical_rank();
+  } else {
+    MPI_Comm_rank(parent, &key);
+  }
+  MPI_Comm ordered;
+  MPI_Comm_split(parent, 0, key, &ordered);
+  MPI_Cart_create(ordered, 2, grid_dim, (int[]){0, 0}, 0, &comm2d);
+  MPI_Comm_free(&ordered);
+  MPI_Comm_rank(comm2d, &rank);
   MPI_Cart_coords(comm2d, rank, 2, grid_coord);
 
   // Compute the neighbors
@@ -64,305 +642,1299 @@ static void setup_2D_topology() {
   MPI_Cart_shift(comm2d, 1, 1, &rank_up, &rank_down);
 
   // Compute the local size without halo or borders
-  local_size_x = (size_x - 2) / grid_dim[0];
-  local_size_y = (size_y - 2) / grid_dim[1];
+  local_size_x = (size_x - 2 * STENCIL_RADIUS) / grid_dim[0];
+  local_size_y = (size_y - 2 * STENCIL_RADIUS) / grid_dim[1];
+  local_x0 = grid_coord[0] * local_size_x;
+  local_y0 = grid_coord[1] * local_size_y;
+}
+
+/** print the placement and how many halo cells cross node boundaries */
+static void report_placement() {
+  int node_index, node_count;
+  MPI_Comm node = split_domain(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED,
+                               &node_index, &node_count);
+  if (node != MPI_COMM_NULL) {
+    MPI_Comm_free(&node);
+  }
+
+  int neighbor[4] = {rank_up, rank_down, rank_left, rank_right};
+  int halo_cells[4] = {
+      STENCIL_RADIUS * LOCAL_STRIDE, STENCIL_RADIUS * LOCAL_STRIDE,
+      STENCIL_RADIUS * local_size_y, STENCIL_RADIUS * local_size_y};
+  long cells[2] = {0, 0}; // all halo cells, halo cells from another node
+  for (int d = 0; d < 4; d++) {
+    int other = node_index;
+    MPI_Sendrecv(&node_index, 1, MPI_INT, neighbor[d], 1, &other, 1, MPI_INT,
+                 neighbor[d], 1, comm2d, MPI_STATUS_IGNORE);
+    if (neighbor[d] != MPI_PROC_NULL) {
+      cells[0] += halo_cells[d];
+      cells[1] += other != node_index ? halo_cells[d] : 0;
+    }
+  }
+  long total[2];
+  MPI_Reduce(cells, total, 2, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+  if (rank == 0) {
+    if (node_dim[0] > 0) {
+      printf("# placement = %dx%d node blocks of %dx%d ranks\n", node_dim[0],
+             node_dim[1], grid_dim[0] / node_dim[0], grid_dim[1] / node_dim[1]);
+    } else {
+      printf("# placement = flat\n");
+    }
+    printf("# off-node halo cells = %ld / %ld\n", total[1], total[0]);
+  }
+}
+
+/** Thomas coefficients of the constant tridiagonal system
+ * -h x[i-1] + (1 + 2h) x[i] - h x[i+1] = d[i], i < n */
+static void adi_coefficients(int n, stencil_t h, stencil_t *cp,
+                             stencil_t *inv) {
+  double c_prev = 0.0;
+  for (int i = 0; i < n; i++) {
+    double m = 1.0 + 2.0 * h + h * c_prev;
+    inv[i] = 1.0 / m;
+    c_prev = -h / m;
+    cp[i] = c_prev;
+  }
+}
+
+/** solve lines [l0, l1) of a batch of n x m right-hand sides stored line
+ * index fastest (d[i * m + l]) in place; the inner loops run across lines */
+static void thomas_batch(stencil_t *d, int n, int m, int l0, int l1,
+                         const stencil_t *cp, const stencil_t *inv,
+                         stencil_t h) {
+  for (int l = l0; l < l1; l++) {
+    d[l] *= inv[0];
+  }
+  for (int i = 1; i < n; i++) {
+    for (int l = l0; l < l1; l++) {
+      d[i * m + l] = (d[i * m + l] + h * d[(i - 1) * m + l]) * inv[i];
+    }
+  }
+  for (int i = n - 2; i >= 0; i--) {
+    for (int l = l0; l < l1; l++) {
+      d[i * m + l] -= cp[i] * d[(i + 1) * m + l];
+    }
+  }
+}
+
+/** plan a sweep whose lines have local_n cells here, lines lines crossing
+ * the tile and are split over the ranks of the sub grid kept by remain */
+static void adi_plan(adi_sweep_t *sw, int remain[2], int local_n, int lines) {
+  MPI_Cart_sub(comm2d, remain, &sw->comm);
+  MPI_Comm_size(sw->comm, &sw->ranks);
+  MPI_Comm_rank(sw->comm, &sw->me);
+  sw->n = sw->ranks * local_n;
+  sw->lines = lines;
+  sw->owner = malloc(lines * sizeof(int));
+  sw->slot = malloc(lines * sizeof(int));
+  sw->line_count = malloc(sw->ranks * sizeof(int));
+  sw->send_counts = malloc(sw->ranks * sizeof(int));
+  sw->send_displs = malloc(sw->ranks * sizeof(int));
+  sw->recv_counts = malloc(sw->ranks * sizeof(int));
+  sw->recv_displs = malloc(sw->ranks * sizeof(int));
+  for (int j = 0, l = 0; j < sw->ranks; j++) {
+    sw->line_count[j] = lines / sw->ranks + (j < lines % sw->ranks);
+    for (int k = 0; k < sw->line_count[j]; k++, l++) {
+      sw->owner[l] = j;
+      sw->slot[l] = k;
+    }
+  }
+  for (int j = 0; j < sw->ranks; j++) {
+    sw->send_counts[j] = local_n * sw->line_count[j];
+    sw->send_displs[j] = j == 0 ? 0 : sw->send_displs[j - 1] +
+                                          sw->send_counts[j - 1];
+    sw->recv_counts[j] = local_n * sw->line_count[sw->me];
+    sw->recv_displs[j] = j * sw->recv_counts[j];
+  }
+  sw->cp = malloc(sw->n * sizeof(stencil_t));
+  sw->inv = malloc(sw->n * sizeof(stencil_t));
+  adi_coefficients(sw->n, 0.5 * alpha * adi_factor, sw->cp, sw->inv);
+}
+
+static void adi_unplan(adi_sweep_t *sw) {
+  MPI_Comm_free(&sw->comm);
+  free(sw->owner);
+  free(sw->slot);
+  free(sw->line_count);
+  free(sw->send_counts);
+  free(sw->send_displs);
+  free(sw->recv_counts);
+  free(sw->recv_displs);
+  free(sw->cp);
+  free(sw->inv);
+}
+
+/** plan both sweeps for the current decomposition */
+static void adi_setup() {
+  if (adi_factor <= 0.0) {
+    return;
+  }
+  adi_plan(&adi_sweep_x, (int[]){1, 0}, local_size_x, local_size_y);
+  adi_plan(&adi_sweep_y, (int[]){0, 1}, local_size_y, local_size_x);
+  int cells = local_size_x * local_size_y;
+  int x_cells = adi_sweep_x.n * adi_sweep_x.line_count[0];
+  int y_cells = adi_sweep_y.n * adi_sweep_y.line_count[0];
+  cells = cells > x_cells ? cells : x_cells;
+  cells = cells > y_cells ? cells : y_cells;
+  adi_send = malloc(cells * sizeof(stencil_t));
+  adi_recv = malloc(cells * sizeof(stencil_t));
+}
+
+static void adi_release() {
+  if (adi_factor <= 0.0) {
+    return;
+  }
+  adi_unplan(&adi_sweep_x);
+  adi_unplan(&adi_sweep_y);
+  free(adi_send);
+  free(adi_recv);
+}
+
+/** runs of the active cells of the nx x ny interior at (x0, y0) in the mask,
+ * in halo coordinates; return the run count, only counted if runs is NULL */
+static int mask_tile_runs(int x0, int y0, int nx, int ny, int *starts,
+                          int *out) {
+  int count = 0;
+  for (int y = 0; y < ny; y++) {
+    const uint8_t *row =
+        &mask[x0 + STENCIL_RADIUS + size_x * (y0 + y + STENCIL_RADIUS)];
+    starts[y] = count;
+    for (int x = 0; x < nx; x++) {
+      if (row[x] && (x == 0 || !row[x - 1])) {
+        if (out != NULL) {
+          out[2 * count] = x + STENCIL_RADIUS;
+        }
+      }
+      if (row[x] && (x == nx - 1 || !row[x + 1])) {
+        if (out != NULL) {
+          out[2 * count + 1] = x + 1 + STENCIL_RADIUS;
+        }
+        count++;
+      }
+    }
+  }
+  starts[ny] = count;
+  return count;
+}
+
+/** build the runs of the local tile: one per row without a mask, else sent
+ * by rank 0 from the mask for the tile each rank reports */
+static void setup_runs() {
+  row_runs = malloc((local_size_y + 1) * sizeof(int));
+  if (mask_path[0] == '\0') {
+    runs = malloc(2 * local_size_y * sizeof(int));
+    for (int y = 0; y <= local_size_y; y++) {
+      row_runs[y] = y;
+    }
+    for (int y = 0; y < local_size_y; y++) {
+      runs[2 * y] = STENCIL_RADIUS;
+      runs[2 * y + 1] = local_size_x + STENCIL_RADIUS;
+    }
+    active_cells = (long)local_size_x * local_size_y;
+    return;
+  }
+
+  int local_tile[4] = {local_x0, local_y0, local_size_x, local_size_y};
+  int *tiles = NULL;
+  if (rank == 0) {
+    tiles = malloc(4 * size * sizeof(int));
+  }
+  MPI_Gather(local_tile, 4, MPI_INT, tiles, 4, MPI_INT, 0, comm2d);
+  if (rank == 0) {
+    for (int r = 0; r < size; r++) {
+      const int *tile = &tiles[4 * r];
+      int *starts = malloc((tile[3] + 1) * sizeof(int));
+      int count = mask_tile_runs(tile[0], tile[1], tile[2], tile[3], starts,
+                                 NULL);
+      int *tile_runs = malloc((2 * count + 1) * sizeof(int));
+      mask_tile_runs(tile[0], tile[1], tile[2], tile[3], starts, tile_runs);
+      if (r != 0) {
+        MPI_Send(starts, tile[3] + 1, MPI_INT, r, 0, comm2d);
+        MPI_Send(tile_runs, 2 * count, MPI_INT, r, 0, comm2d);
+        free(starts);
+        free(tile_runs);
+      } else {
+        free(row_runs);
+        row_runs = starts;
+        runs = tile_runs;
+      }
+    }
+    free(tiles);
+  } else {
+    MPI_Recv(row_runs, local_size_y + 1, MPI_INT, 0, 0, comm2d,
+             MPI_STATUS_IGNORE);
+    runs = malloc((2 * row_runs[local_size_y] + 1) * sizeof(int));
+    MPI_Recv(runs, 2 * row_runs[local_size_y], MPI_INT, 0, 0, comm2d,
+             MPI_STATUS_IGNORE);
+  }
+  active_cells = 0;
+  for (int i = 0; i < row_runs[local_size_y]; i++) {
+    active_cells += runs[2 * i + 1] - runs[2 * i];
+  }
 }
 
 static void allocate_local_stencil() {
-  // Allocate the local arrays with halos and initialize to 0
-  local_values =
-      malloc((local_size_x + 2) * (local_size_y + 2) * sizeof(stencil_t));
-  local_prev_values =
-      malloc((local_size_x + 2) * (local_size_y + 2) * sizeof(stencil_t));
-  memset(local_values, 0,
-         (local_size_x + 2) * (local_size_y + 2) * sizeof(stencil_t));
-  memset(local_prev_values, 0,
-         (local_size_x + 2) * (local_size_y + 2) * sizeof(stencil_t));
+  // Allocate the local arrays with halos and initialize to 0 from the
+  // threads that will compute each tile; in place, the second field is
+  // replaced by the halo strips of the tiles and one window per thread,
+  // sized at each step
+  local_values = malloc(LOCAL_CELLS * sizeof(stencil_t));
+  tile_setup(local_size_x, local_size_y);
+  tile_first_touch(local_values);
+  if (!inplace_mode) {
+    local_prev_values = malloc(LOCAL_CELLS * sizeof(stencil_t));
+    tile_first_touch(local_prev_values);
+  }
+  setup_runs();
+  adi_setup();
 }
 
-static void clean_process() {
-  free(local_values);
-  free(local_prev_values);
+static void release_halo_type() {
   MPI_Type_free(&halo_column);
   MPI_Type_free(&halo_row);
+  if (halo_codec != HALO_CODEC_NONE) {
+    for (int d = 0; d < 4; d++) {
+      free(halo_ref_send[d]);
+      free(halo_ref_recv[d]);
+    }
+    free(halo_send_buf);
+    free(halo_recv_buf);
+  }
+}
+
+static void release_2D_topology() {
+  adi_release();
+  free(local_values);
+  free(local_prev_values);
+  free(inplace_rows);
+  free(inplace_cols);
+  free(inplace_windows);
+  free(row_runs);
+  free(runs);
+  local_prev_values = NULL;
+  inplace_rows = inplace_cols = inplace_windows = NULL;
+  row_runs = runs = NULL;
+  inplace_reserved[0] = inplace_reserved[1] = inplace_reserved[2] = 0;
+  release_halo_type();
   MPI_Comm_free(&comm2d);
+}
+
+static void clean_process() {
+  release_2D_topology();
+  tile_release();
   MPI_Finalize();
 }
 
 static void create_halo_type() {
-  // Create the halo column datatype
-  MPI_Type_vector(local_size_y, 1, local_size_x + 2, MPI_FLOAT, &halo_column);
+  // Create the halo column datatype: STENCIL_RADIUS columns of the interior
+  // rows
+  MPI_Type_vector(local_size_y, STENCIL_RADIUS, LOCAL_STRIDE, MPI_FLOAT,
+                  &halo_column);
   MPI_Type_commit(&halo_column);
 
-  // Create the halo row datatype
-  MPI_Type_contiguous(local_size_x, MPI_FLOAT, &halo_row);
+  // Create the halo row datatype: STENCIL_RADIUS full rows, corners included
+  MPI_Type_contiguous(STENCIL_RADIUS * LOCAL_STRIDE, MPI_FLOAT, &halo_row);
   MPI_Type_commit(&halo_row);
+
+  // Halo codec: references start at 0 on both sides of every message
+  if (halo_codec != HALO_CODEC_NONE) {
+    int cells[4] = {STENCIL_RADIUS * local_size_y,
+                    STENCIL_RADIUS * local_size_y,
+                    STENCIL_RADIUS * LOCAL_STRIDE,
+                    STENCIL_RADIUS * LOCAL_STRIDE};
+    for (int d = 0; d < 4; d++) {
+      halo_ref_send[d] = calloc(cells[d], sizeof(stencil_t));
+      halo_ref_recv[d] = calloc(cells[d], sizeof(stencil_t));
+    }
+    int max_cells = cells[0] > cells[2] ? cells[0] : cells[2];
+    halo_send_buf = malloc((2 * max_cells + 1) * sizeof(uint16_t));
+    halo_recv_buf = malloc((2 * max_cells + 1) * sizeof(uint16_t));
+    halo_coded_messages = halo_raw_messages = 0.0;
+    halo_sent_bytes = halo_float_bytes = 0.0;
+  }
 }
 
-/** init stencil values to 0, borders to non-zero */
-static void stencil_init(void) {
-  values = malloc(size_x * size_y * sizeof(stencil_t));
-  prev_values = malloc(size_x * size_y * sizeof(stencil_t));
+/** init a global field to 0, borders of STENCIL_RADIUS cells to non-zero */
+static void global_stencil_init(stencil_t *field) {
   int x, y;
   for (x = 0; x < size_x; x++) {
     for (y = 0; y < size_y; y++) {
-      values[x + size_x * y] = 0.0;
+      field[x + size_x * y] = 0.0;
     }
   }
-  for (x = 0; x < size_x; x++) {
-    values[x + size_x * 0] = x;
-    values[x + size_x * (size_y - 1)] = size_x - 1 - x;
+  for (y = 0; y < STENCIL_RADIUS; y++) {
+    for (x = 0; x < size_x; x++) {
+      field[x + size_x * y] = x;
+      field[x + size_x * (size_y - 1 - y)] = size_x - 1 - x;
+    }
   }
   for (y = 0; y < size_y; y++) {
-    values[0 + size_x * y] = y;
-    values[size_x - 1 + size_x * y] = size_y - 1 - y;
+    for (x = 0; x < STENCIL_RADIUS; x++) {
+      field[x + size_x * y] = y;
+      field[size_x - 1 - x + size_x * y] = size_y - 1 - y;
+    }
+  }
+}
+
+/** init stencil values on rank 0 */
+static void stencil_init(void) {
+  values = malloc(size_x * size_y * sizeof(stencil_t));
+  global_stencil_init(values);
+}
+
+/** on rank 0, read the binary PGM (P5) mask of the whole grid, borders
+ * included; nonzero pixels are the active cells, the others keep their
+ * initial value like the borders */
+static int mask_load() {
+  FILE *in = fopen(mask_path, "rb");
+  int width, height, maxval;
+  if (in == NULL ||
+      fscanf(in, "P5 %d %d %d", &width, &height, &maxval) != 3 ||
+      width != size_x || height != size_y || maxval > 255 ||
+      fgetc(in) == EOF) {
+    fprintf(stderr, "%s: not a %dx%d 8-bit PGM mask\n", mask_path, size_x,
+            size_y);
+    if (in != NULL) {
+      fclose(in);
+    }
+    return -1;
+  }
+  mask = malloc((size_t)size_x * size_y);
+  size_t read = fread(mask, 1, (size_t)size_x * size_y, in);
+  fclose(in);
+  if (read != (size_t)size_x * size_y) {
+    fprintf(stderr, "%s: truncated mask\n", mask_path);
+    return -1;
+  }
+  return 0;
+}
+
+/** print the active cells and how evenly the tiles spread them */
+static void mask_report() {
+  if (mask_path[0] == '\0') {
+    return;
+  }
+  long total, most;
+  MPI_Reduce(&active_cells, &total, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+  MPI_Reduce(&active_cells, &most, 1, MPI_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+  if (rank == 0) {
+    printf("# mask = %s, %ld / %ld active cells\n", mask_path, total,
+           (long)(size_x - 2 * STENCIL_RADIUS) * (size_y - 2 * STENCIL_RADIUS));
+    printf("# mask imbalance = %g (most active cells on a rank / mean)\n",
+           total > 0 ? most * (double)size / total : 0.0);
   }
-  memcpy(prev_values, values, size_x * size_y * sizeof(stencil_t));
 }
 
 static int setup_option(int argc, char **argv) {
   if (rank == 0) {
-    int stencil_size;
+    int stencil_size = 10;
     int opt;
-    while ((opt = getopt(argc, argv, "t")) != -1) {
+    while ((opt = getopt(argc, argv, "tiakb:A:s:o:d:c:S:r:w:B:P:T:C:e:H:m:")) !=
+           -1) {
       switch (opt) {
       case 't':
         test_mode = 1;
         break;
+      case 'i':
+        inplace_mode = 1;
+        break;
+      case 'a':
+        autotune_mode = 1;
+        break;
+      case 'k':
+        chebyshev_mode = 1;
+        break;
+      case 'A':
+        adi_factor = atof(optarg);
+        break;
+      case 'b':
+        tile_set = sscanf(optarg, "%dx%d", &tile_x, &tile_y) == 2;
+        break;
+      case 's':
+        snapshot_every = atoi(optarg);
+        break;
+      case 'o':
+        snprintf(snapshot_prefix, sizeof(snapshot_prefix), "%s", optarg);
+        break;
+      case 'd':
+        snapshot_factor = atoi(optarg);
+        break;
+      case 'S':
+        snprintf(server_path, sizeof(server_path), "%s", optarg);
+        break;
+      case 'e':
+        snprintf(trace_path, sizeof(trace_path), "%s", optarg);
+        break;
+      case 'm':
+        snprintf(mask_path, sizeof(mask_path), "%s", optarg);
+        break;
+      case 'P':
+        parareal_slices = atoi(optarg);
+        break;
+      case 'T':
+        parareal_steps = atoi(optarg);
+        break;
+      case 'C':
+        parareal_coarse = atoi(optarg);
+        break;
+      case 'r':
+        snprintf(warm_read_prefix, sizeof(warm_read_prefix), "%s", optarg);
+        break;
+      case 'w':
+        snprintf(warm_write_prefix, sizeof(warm_write_prefix), "%s", optarg);
+        break;
+      case 'B': {
+        static const char *sides[4] = {"up", "down", "left", "right"};
+        char side[16];
+        float value;
+        if (sscanf(optarg, "%15[a-z]=%f", side, &value) == 2) {
+          for (int i = 0; i < 4; i++) {
+            if (strcmp(side, sides[i]) == 0) {
+              boundary_set[i] = 1;
+              boundary_value[i] = value;
+            }
+          }
+        }
+        break;
+      }
+      case 'c':
+        if (strcmp(optarg, "none") == 0) {
+          snapshot_codec = SNAPSHOT_CODEC_NONE;
+          break;
+        }
+        if (strcmp(optarg, "lz") == 0) {
+          snapshot_codec = SNAPSHOT_CODEC_LZ;
+          break;
+        }
+        if (strcmp(optarg, "lossy") == 0) {
+          snapshot_codec = SNAPSHOT_CODEC_LOSSY;
+          break;
+        }
+        // unknown codec: fall through to the usage message
+      case 'H':
+        if (opt == 'H') {
+          if (strcmp(optarg, "none") == 0) {
+            halo_codec = HALO_CODEC_NONE;
+            break;
+          }
+          if (strcmp(optarg, "fp16") == 0) {
+            halo_codec = HALO_CODEC_FP16;
+            break;
+          }
+          if (strcmp(optarg, "bf16") == 0) {
+            halo_codec = HALO_CODEC_BF16;
+            break;
+          }
+        }
+        // unknown codec: fall through to the usage message
       default:
-        fprintf(stderr, "Usage: %s [stencil size] [-t]\n", argv[0]);
+        fprintf(stderr,
+                "Usage: %s [stencil size] [-t] [-i] [-a] [-k] [-b tile XxY] "
+                "[-A ADI step factor] [-s snapshot period] "
+                "[-o snapshot prefix] "
+                "[-d downsample factor] [-c none|lz|lossy] "
+                "[-S server socket] [-r warm start prefix] "
+                "[-w solution prefix] [-B up|down|left|right=value] "
+                "[-P time slices] [-T fine steps] "
+                "[-C coarse steps per slice] "
+                "[-e trace file] [-H none|fp16|bf16] "
+                "[-m mask PGM file]\n",
+                argv[0]);
         return -1;
       }
     }
     if (optind < argc) {
       stencil_size = atoi(argv[optind]);
-      if (stencil_size < 2) {
-        fprintf(stderr, "Stencil size must be >= 2. Using default (10).\n");
+      if (stencil_size < 2 * STENCIL_RADIUS) {
+        fprintf(stderr, "Stencil size must be >= %d. Using default (10).\n",
+                2 * STENCIL_RADIUS);
         stencil_size = 10;
       }
     }
 
+    if (adi_factor > 0.0 && STENCIL != STENCIL_STAR5) {
+      fprintf(stderr, "ADI steps need the star5 stencil.\n");
+      return -1;
+    }
+    if (chebyshev_mode &&
+        (inplace_mode || adi_factor > 0.0 || parareal_slices > 0)) {
+      fprintf(stderr, "Chebyshev steps need two fields, without -i, -A or "
+                      "-P.\n");
+      return -1;
+    }
+    if (inplace_mode && (adi_factor > 0.0 || parareal_slices > 0)) {
+      fprintf(stderr, "In-place steps are explicit, without -A or -P.\n");
+      return -1;
+    }
+    if (mask_path[0] != '\0' &&
+        (adi_factor > 0.0 || parareal_slices > 0 || server_path[0] != '\0')) {
+      fprintf(stderr, "Masked domains run explicit steps, without -A, -P or "
+                      "-S.\n");
+      return -1;
+    }
+    if (parareal_slices > 0 &&
+        (STENCIL != STENCIL_STAR5 || size % parareal_slices != 0 ||
+         parareal_steps < parareal_slices || parareal_coarse < 1)) {
+      fprintf(stderr, "Parareal needs the star5 stencil, a slice count "
+                      "dividing the ranks and at least one step per slice.\n");
+      return -1;
+    }
+
     size_x = stencil_size;
     size_y = stencil_size;
 
     MPI_Bcast(&size_x, 1, MPI_INT, 0, MPI_COMM_WORLD);
     MPI_Bcast(&size_y, 1, MPI_INT, 0, MPI_COMM_WORLD);
 
-    printf("# init:\n");
-    stencil_init();
-    printf("# size = %d\n", stencil_size);
+    // the job server sets up each grid when a job asks for it
+    if (mask_path[0] != '\0' && mask_load() != 0) {
+      return -1;
+    }
+    if (server_path[0] == '\0') {
+      printf("# init:\n");
+      stencil_init();
+      printf("# size = %d\n", stencil_size);
+      printf("# stencil = %s\n", STENCIL_NAME);
+    }
   } else {
     MPI_Bcast(&size_x, 1, MPI_INT, 0, MPI_COMM_WORLD);
     MPI_Bcast(&size_y, 1, MPI_INT, 0, MPI_COMM_WORLD);
   }
+  MPI_Bcast(&snapshot_every, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(snapshot_prefix, sizeof(snapshot_prefix), MPI_CHAR, 0,
+            MPI_COMM_WORLD);
+  MPI_Bcast(&snapshot_factor, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&snapshot_codec, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&autotune_mode, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&test_mode, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&inplace_mode, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&chebyshev_mode, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&adi_factor, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  MPI_Bcast(server_path, sizeof(server_path), MPI_CHAR, 0, MPI_COMM_WORLD);
+  MPI_Bcast(trace_path, sizeof(trace_path), MPI_CHAR, 0, MPI_COMM_WORLD);
+  MPI_Bcast(mask_path, sizeof(mask_path), MPI_CHAR, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&halo_codec, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&parareal_slices, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&parareal_steps, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&parareal_coarse, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(warm_read_prefix, sizeof(warm_read_prefix), MPI_CHAR, 0,
+            MPI_COMM_WORLD);
+  MPI_Bcast(warm_write_prefix, sizeof(warm_write_prefix), MPI_CHAR, 0,
+            MPI_COMM_WORLD);
+  MPI_Bcast(boundary_set, 4, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(boundary_value, 4, MPI_FLOAT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&tile_x, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&tile_y, 1, MPI_INT, 0, MPI_COMM_WORLD);
   return 0;
 }
 
 static void stencil_free(void) {
   free(values);
-  free(prev_values);
+  free(mask);
+  mask = NULL;
 }
 
-static void stencil_display(int start_x, int end_x, int start_y, int end_y) {
-  for (int y = start_y; y <= end_y; y++) {
-    for (int x = start_x; x <= end_x; x++) {
-      printf("%g ", values[x + size_x * y]);
-    }
-    printf("\n");
+/** copy a block of rows x cols cells between two fields of row strides
+ * src_stride and dst_stride */
+static void copy_block(stencil_t *dst, int dst_stride, const stencil_t *src,
+                       int src_stride, int cols, int rows) {
+  for (int y = 0; y < rows; y++) {
+    memcpy(&dst[dst_stride * y], &src[src_stride * y],
+           cols * sizeof(stencil_t));
   }
 }
 
 static void distribute_stencils() {
+  double t = trace_now();
   if (rank == 0) {
+    // each tile is sent straight out of the global field, halo included
+    MPI_Datatype global_tile;
+    MPI_Type_vector(local_size_y + 2 * STENCIL_RADIUS, LOCAL_STRIDE, size_x,
+                    MPI_FLOAT, &global_tile);
+    MPI_Type_commit(&global_tile);
     for (int r = 0; r < size; r++) {
       int coords[2];
       MPI_Cart_coords(comm2d, r, 2, coords);
 
       int start_x = coords[0] * local_size_x;
       int start_y = coords[1] * local_size_y;
-
-      stencil_t *temp =
-          malloc((local_size_x + 2) * (local_size_y + 2) * sizeof(stencil_t));
-      memset(temp, 0,
-             (local_size_x + 2) * (local_size_y + 2) * sizeof(stencil_t));
-
-      for (int y = 0; y < local_size_y + 2; y++) {
-        for (int x = 0; x < local_size_x + 2; x++) {
-          temp[IND(x, y)] = values[(start_x + x) + size_x * (start_y + y)];
-        }
-      }
+      stencil_t *tile = &values[start_x + size_x * start_y];
 
       if (r != 0) {
-        MPI_Send(temp, (local_size_x + 2) * (local_size_y + 2), MPI_FLOAT, r, 0,
-                 MPI_COMM_WORLD);
+        MPI_Send(tile, 1, global_tile, r, 0, comm2d);
       } else {
-        memcpy(local_values, temp,
-               (local_size_x + 2) * (local_size_y + 2) * sizeof(stencil_t));
-        memcpy(local_prev_values, temp,
-               (local_size_x + 2) * (local_size_y + 2) * sizeof(stencil_t));
+        copy_block(local_values, LOCAL_STRIDE, tile, size_x, LOCAL_STRIDE,
+                   local_size_y + 2 * STENCIL_RADIUS);
       }
-
-      free(temp);
     }
+    MPI_Type_free(&global_tile);
   } else {
-    MPI_Recv(local_values, (local_size_x + 2) * (local_size_y + 2), MPI_FLOAT,
-             0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-    memcpy(local_prev_values, local_values,
-           (local_size_x + 2) * (local_size_y + 2) * sizeof(stencil_t));
+    MPI_Recv(local_values, LOCAL_CELLS, MPI_FLOAT,
+             0, 0, comm2d, MPI_STATUS_IGNORE);
+  }
+  if (local_prev_values != NULL) {
+    memcpy(local_prev_values, local_values, LOCAL_CELLS * sizeof(stencil_t));
   }
+  trace_record(TRACE_SCATTER, t);
 }
 
 static void global_stencil() {
+  // the interiors go straight from the local fields to the global one
+  double t = trace_now();
+  MPI_Datatype local_interior;
+  MPI_Type_vector(local_size_y, local_size_x, LOCAL_STRIDE, MPI_FLOAT,
+                  &local_interior);
+  MPI_Type_commit(&local_interior);
+  const stencil_t *interior =
+      &local_values[IND(STENCIL_RADIUS, STENCIL_RADIUS)];
   if (rank == 0) {
+    MPI_Datatype global_interior;
+    MPI_Type_vector(local_size_y, local_size_x, size_x, MPI_FLOAT,
+                    &global_interior);
+    MPI_Type_commit(&global_interior);
     for (int r = 0; r < size; r++) {
       int coords[2];
       MPI_Cart_coords(comm2d, r, 2, coords);
 
-      int start_x = coords[0] * local_size_x + 1;
-      int start_y = coords[1] * local_size_y + 1;
+      int start_x = coords[0] * local_size_x + STENCIL_RADIUS;
+      int start_y = coords[1] * local_size_y + STENCIL_RADIUS;
+      stencil_t *tile = &values[start_x + size_x * start_y];
 
       if (r != 0) {
-        stencil_t *recv_temp =
-            malloc(local_size_x * local_size_y * sizeof(stencil_t));
-        memset(recv_temp, 0, local_size_x * local_size_y * sizeof(stencil_t));
-        MPI_Recv(recv_temp, local_size_x * local_size_y, MPI_FLOAT, r, 0,
-                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-
-        for (int y = 0; y < local_size_y; y++) {
-          for (int x = 0; x < local_size_x; x++) {
-            values[(start_x + x) + size_x * (start_y + y)] =
-                recv_temp[x + local_size_x * y];
-          }
-        }
+        MPI_Recv(tile, 1, global_interior, r, 0, comm2d, MPI_STATUS_IGNORE);
       } else {
-        for (int y = 0; y < local_size_y; y++) {
-          for (int x = 0; x < local_size_x; x++) {
-            values[(start_x + x) + size_x * (start_y + y)] =
-                local_values[IND(x + 1, y + 1)];
-          }
-        }
+        copy_block(tile, size_x, interior, LOCAL_STRIDE, local_size_x,
+                   local_size_y);
       }
     }
+    MPI_Type_free(&global_interior);
   } else {
-    stencil_t *temp = malloc(local_size_x * local_size_y * sizeof(stencil_t));
-    memset(temp, 0, local_size_x * local_size_y * sizeof(stencil_t));
-
-    for (int y = 1; y <= local_size_y; y++) {
-      for (int x = 1; x <= local_size_x; x++) {
-        temp[(x - 1) + local_size_x * (y - 1)] = local_values[IND(x, y)];
-      }
-    }
-    MPI_Send(temp, local_size_x * local_size_y, MPI_FLOAT, 0, 0,
-             MPI_COMM_WORLD);
-    free(temp);
+    MPI_Send(interior, 1, local_interior, 0, 0, comm2d);
   }
+  MPI_Type_free(&local_interior);
+  trace_record(TRACE_GATHER, t);
 }
 
-static int stencil_step(void) {
-  int convergence = 1;
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
 
-  stencil_t *tmp = prev_values;
-  prev_values = values;
-  values = tmp;
+/** worst-case size of an lz_compress() output */
+static size_t lz_bound(size_t n) { return n + n / 255 + 16; }
 
-  int x, y;
-  for (y = 1; y < size_y - 1; y++) {
-    for (x = 1; x < size_x - 1; x++) {
-      values[x + size_x * y] =
-          alpha * (prev_values[x - 1 + size_x * y] +
-                   prev_values[x + 1 + size_x * y] +
-                   prev_values[x + size_x * (y - 1)] +
-                   prev_values[x + size_x * (y + 1)]) +
-          (1.0 - 4.0 * alpha) * prev_values[x + size_x * y];
-      if (convergence && (fabs(prev_values[x + size_x * y] -
-                               values[x + size_x * y]) > epsilon)) {
-        convergence = 0;
-      }
-    }
+/** write the extra bytes of a length whose 4-bit field saturated at 15 */
+static size_t lz_write_length(uint8_t *out, size_t len) {
+  size_t op = 0;
+  for (len -= 15; len >= 255; len -= 255) {
+    out[op++] = 255;
   }
-  return convergence;
+  out[op++] = (uint8_t)len;
+  return op;
 }
 
-static void test() {
-  printf("Test mode\n");
-  stencil_display(0, size_x - 1, 0, size_y - 1);
-  stencil_t *test_values = malloc(size_x * size_y * sizeof(stencil_t));
-  memcpy(test_values, values, size_x * size_y * sizeof(stencil_t));
-  stencil_free();
-  stencil_init();
-  int s;
-  int convergence = 0;
-  for (s = 0; s < stencil_max_steps; s++) {
-    convergence = stencil_step();
-    if (convergence) {
+/** emit literals [lit, lit + nlit) followed by an optional match */
+static size_t lz_write_sequence(uint8_t *out, const uint8_t *lit, size_t nlit,
+                                size_t offset, size_t match) {
+  size_t op = 1;
+  int lit_code = nlit < 15 ? (int)nlit : 15;
+  int match_code = 0;
+  if (nlit >= 15) {
+    op += lz_write_length(&out[op], nlit);
+  }
+  memcpy(&out[op], lit, nlit);
+  op += nlit;
+  if (match > 0) {
+    match_code = match - LZ_MIN_MATCH < 15 ? (int)(match - LZ_MIN_MATCH) : 15;
+    out[op++] = offset & 0xff;
+    out[op++] = offset >> 8;
+    if (match - LZ_MIN_MATCH >= 15) {
+      op += lz_write_length(&out[op], match - LZ_MIN_MATCH);
+    }
+  }
+  out[0] = (uint8_t)(lit_code << 4 | match_code);
+  return op;
+}
+
+/** LZ77 compression in the LZ4 sequence layout, returns the output size */
+static size_t lz_compress(const uint8_t *in, size_t n, uint8_t *out) {
+  uint32_t table[1 << LZ_HASH_BITS]; // last position + 1 of each hash
+  memset(table, 0, sizeof(table));
+  size_t ip = 0, anchor = 0, op = 0;
+  while (ip + LZ_MIN_MATCH <= n) {
+    uint32_t seq;
+    memcpy(&seq, &in[ip], sizeof(seq));
+    uint32_t h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+    size_t ref = table[h];
+    table[h] = ip + 1;
+    if (ref == 0 || ip - (ref - 1) > LZ_MAX_OFFSET ||
+        memcmp(&in[ref - 1], &in[ip], LZ_MIN_MATCH) != 0) {
+      ip++;
+      continue;
+    }
+    size_t match = LZ_MIN_MATCH;
+    while (ip + match < n && in[ref - 1 + match] == in[ip + match]) {
+      match++;
+    }
+    op += lz_write_sequence(&out[op], &in[anchor], ip - anchor,
+                            ip - (ref - 1), match);
+    ip += match;
+    anchor = ip;
+  }
+  op += lz_write_sequence(&out[op], &in[anchor], n - anchor, 0, 0);
+  return op;
+}
+
+/** compress rows [y0, y1) of a staged tile, returns the output size */
+static size_t snapshot_compress_chunk(const stencil_t *data, int y0, int y1,
+                                      uint8_t *scratch, uint8_t *out) {
+  size_t n = (size_t)snapshot_nx * (y1 - y0);
+  const stencil_t *src = &data[snapshot_nx * y0];
+  // split every 32-bit word into 4 byte planes so that the slowly varying
+  // high bytes form long runs for the LZ stage
+  for (size_t i = 0; i < n; i++) {
+    uint32_t word;
+    if (snapshot_codec == SNAPSHOT_CODEC_LOSSY) {
+      // |v - quantum * q| <= epsilon, then zigzag deltas along the row
+      const stencil_t quantum = 2.0 * epsilon;
+      int32_t q = (int32_t)lrintf(src[i] / quantum);
+      int32_t prev =
+          i % snapshot_nx == 0 ? 0 : (int32_t)lrintf(src[i - 1] / quantum);
+      int32_t delta = q - prev;
+      word = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+    } else {
+      memcpy(&word, &src[i], sizeof(word));
+    }
+    for (int b = 0; b < 4; b++) {
+      scratch[b * n + i] = (word >> (8 * b)) & 0xff;
+    }
+  }
+  return lz_compress(scratch, 4 * n, out);
+}
+
+/** background writer: drains the staging slots in order */
+static void *snapshot_writer(void *arg) {
+  (void)arg;
+  int w = 0;
+  for (;;) {
+    pthread_mutex_lock(&snapshot_lock);
+    while (!snapshot_slots[w].full && !snapshot_done) {
+      pthread_cond_wait(&snapshot_cond, &snapshot_lock);
+    }
+    if (!snapshot_slots[w].full) {
+      pthread_mutex_unlock(&snapshot_lock);
       break;
     }
+    pthread_mutex_unlock(&snapshot_lock);
+
+    struct timespec t1, t2, t3;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    snapshot_slot_t *slot = &snapshot_slots[w];
+    double out_bytes = 0.0;
+    for (int c = 0; c < snapshot_nchunks; c++) {
+      int y0 = c * snapshot_chunk_rows;
+      int y1 = y0 + snapshot_chunk_rows < snapshot_ny
+                   ? y0 + snapshot_chunk_rows
+                   : snapshot_ny;
+      if (snapshot_codec == SNAPSHOT_CODEC_NONE) {
+        slot->chunk_size[c] = (y1 - y0) * snapshot_nx * sizeof(stencil_t);
+      } else {
+        slot->chunk_size[c] = snapshot_compress_chunk(
+            slot->data, y0, y1,
+            &slot->scratch[sizeof(stencil_t) * snapshot_nx * y0],
+            &slot->payload[snapshot_chunk_bound * c]);
+      }
+      out_bytes += slot->chunk_size[c];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+    snapshot_header_t header = {slot->step,
+                                (size_x + snapshot_factor - 1) /
+                                    snapshot_factor,
+                                (size_y + snapshot_factor - 1) /
+                                    snapshot_factor,
+                                snapshot_x0 / snapshot_factor,
+                                snapshot_y0 / snapshot_factor,
+                                snapshot_nx,
+                                snapshot_ny,
+                                snapshot_factor,
+                                snapshot_codec,
+                                snapshot_chunk_rows,
+                                snapshot_nchunks,
+                                2.0 * epsilon};
+    fwrite(&header, sizeof(header), 1, snapshot_file);
+    fwrite(slot->chunk_size, sizeof(uint32_t), snapshot_nchunks,
+           snapshot_file);
+    for (int c = 0; c < snapshot_nchunks; c++) {
+      if (snapshot_codec == SNAPSHOT_CODEC_NONE) {
+        fwrite(&slot->data[snapshot_nx * snapshot_chunk_rows * c], 1,
+               slot->chunk_size[c], snapshot_file);
+      } else {
+        fwrite(&slot->payload[snapshot_chunk_bound * c], 1,
+               slot->chunk_size[c], snapshot_file);
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t3);
+    snapshot_compress_usec += elapsed_usec(&t1, &t2);
+    snapshot_write_usec += elapsed_usec(&t2, &t3);
+    snapshot_out_bytes += out_bytes + sizeof(snapshot_header_t) +
+                          snapshot_nchunks * sizeof(uint32_t);
+
+    pthread_mutex_lock(&snapshot_lock);
+    slot->full = 0;
+    pthread_cond_broadcast(&snapshot_cond);
+    pthread_mutex_unlock(&snapshot_lock);
+    w ^= 1;
   }
+  return NULL;
+}
 
-  int mismatch = 0;
-  int x, y;
-  for (x = 0; x < size_x; x++) {
-    for (y = 0; y < size_y; y++) {
-      if (fabs(values[x + size_x * y] - test_values[x + size_x * y]) >
-          epsilon) {
-        mismatch = 1;
-        printf("Mismatch at (%d, %d): seq = %g, test = %g\n", x, y,
-               values[x + size_x * y], test_values[x + size_x * y]);
+/** first multiple of factor in [start, end) and the number of multiples */
+static void snapshot_sample_range(int start, int end, int *first, int *count) {
+  *first = (start + snapshot_factor - 1) / snapshot_factor * snapshot_factor;
+  *count = *first < end ? (end - *first + snapshot_factor - 1) / snapshot_factor
+                        : 0;
+}
+
+/** open the per-rank snapshot file and start the writer thread */
+static void snapshot_start() {
+  if (snapshot_every <= 0) {
+    return;
+  }
+  if (snapshot_factor < 1) {
+    snapshot_factor = 1;
+  }
+  int start_x = local_x0 + STENCIL_RADIUS;
+  int start_y = local_y0 + STENCIL_RADIUS;
+  snapshot_sample_range(start_x, start_x + local_size_x, &snapshot_x0,
+                        &snapshot_nx);
+  snapshot_sample_range(start_y, start_y + local_size_y, &snapshot_y0,
+                        &snapshot_ny);
+  snapshot_chunk_rows = snapshot_nx > 0 ? SNAPSHOT_CHUNK_CELLS / snapshot_nx : 1;
+  if (snapshot_chunk_rows < 1) {
+    snapshot_chunk_rows = 1;
+  }
+  snapshot_nchunks =
+      (snapshot_ny + snapshot_chunk_rows - 1) / snapshot_chunk_rows;
+  snapshot_chunk_bound =
+      lz_bound(4 * (size_t)snapshot_nx * snapshot_chunk_rows);
+
+  char path[300];
+  snprintf(path, sizeof(path), "%s_%d.bin", snapshot_prefix, rank);
+  snapshot_file = fopen(path, "wb");
+  if (snapshot_file == NULL) {
+    fprintf(stderr, "rank %d: cannot open %s, snapshots disabled\n", rank,
+            path);
+  }
+  // every rank drops the snapshots if one cannot write them, so that all of
+  // them skip the reductions of snapshot_finish()
+  int opened = snapshot_file != NULL;
+  MPI_Allreduce(MPI_IN_PLACE, &opened, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+  if (!opened) {
+    if (snapshot_file != NULL) {
+      fclose(snapshot_file);
+      snapshot_file = NULL;
+      remove(path);
+    }
+    snapshot_every = 0;
+    return;
+  }
+  for (int i = 0; i < 2; i++) {
+    snapshot_slots[i].data =
+        malloc((size_t)snapshot_nx * snapshot_ny * sizeof(stencil_t));
+    snapshot_slots[i].scratch =
+        malloc((size_t)snapshot_nx * snapshot_ny * sizeof(stencil_t));
+    snapshot_slots[i].payload = malloc(snapshot_chunk_bound * snapshot_nchunks);
+    snapshot_slots[i].chunk_size = malloc(snapshot_nchunks * sizeof(uint32_t));
+    snapshot_slots[i].full = 0;
+  }
+  snapshot_next = 0;
+  snapshot_done = 0;
+  pthread_create(&snapshot_thread, NULL, snapshot_writer, NULL);
+}
+
+/** downsample the local tile into a free staging slot, then hand it to the
+ * writer, which compresses it off the steps' critical path */
+static void snapshot_take(int step) {
+  struct timespec t0, t1, t2;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  snapshot_slot_t *slot = &snapshot_slots[snapshot_next];
+  pthread_mutex_lock(&snapshot_lock);
+  while (slot->full) {
+    pthread_cond_wait(&snapshot_cond, &snapshot_lock);
+  }
+  pthread_mutex_unlock(&snapshot_lock);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  const int lx = snapshot_x0 - local_x0;
+  const int ly = snapshot_y0 - local_y0;
+#pragma omp parallel for
+  for (int y = 0; y < snapshot_ny; y++) {
+    if (snapshot_factor == 1) {
+      memcpy(&slot->data[snapshot_nx * y], &local_values[IND(lx, ly + y)],
+             snapshot_nx * sizeof(stencil_t));
+    } else {
+      for (int x = 0; x < snapshot_nx; x++) {
+        slot->data[x + snapshot_nx * y] = local_values[IND(
+            lx + snapshot_factor * x, ly + snapshot_factor * y)];
       }
     }
   }
-  if (mismatch) {
-    printf("Results do not match! Expected:\n");
-    stencil_display(0, size_x - 1, 0, size_y - 1);
+  clock_gettime(CLOCK_MONOTONIC, &t2);
+
+  pthread_mutex_lock(&snapshot_lock);
+  slot->step = step;
+  slot->full = 1;
+  pthread_cond_broadcast(&snapshot_cond);
+  pthread_mutex_unlock(&snapshot_lock);
+
+  snapshot_wait_usec += elapsed_usec(&t0, &t1);
+  snapshot_copy_usec += elapsed_usec(&t1, &t2);
+  snapshot_raw_bytes += (double)snapshot_nx * snapshot_ny * sizeof(stencil_t);
+  snapshot_count++;
+  snapshot_next ^= 1;
+}
+
+/** drain pending snapshots, stop the writer and report the overhead */
+static void snapshot_finish() {
+  if (snapshot_every <= 0) {
+    return;
+  }
+  pthread_mutex_lock(&snapshot_lock);
+  snapshot_done = 1;
+  pthread_cond_broadcast(&snapshot_cond);
+  pthread_mutex_unlock(&snapshot_lock);
+  pthread_join(snapshot_thread, NULL);
+  fclose(snapshot_file);
+  for (int i = 0; i < 2; i++) {
+    free(snapshot_slots[i].data);
+    free(snapshot_slots[i].scratch);
+    free(snapshot_slots[i].payload);
+    free(snapshot_slots[i].chunk_size);
+  }
+
+  double local_usec[4] = {snapshot_copy_usec, snapshot_compress_usec,
+                          snapshot_wait_usec, snapshot_write_usec};
+  double max_usec[4];
+  MPI_Reduce(local_usec, max_usec, 4, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+  double local_bytes[2] = {snapshot_raw_bytes, snapshot_out_bytes};
+  double total_bytes[2];
+  MPI_Reduce(local_bytes, total_bytes, 2, MPI_DOUBLE, MPI_SUM, 0,
+             MPI_COMM_WORLD);
+  if (rank == 0) {
+    printf("# snapshots = %d\n", snapshot_count);
+    printf("# snapshot copy = %g usecs.\n", max_usec[0]);
+    printf("# snapshot compress = %g usecs.\n", max_usec[1]);
+    printf("# snapshot wait = %g usecs.\n", max_usec[2]);
+    printf("# snapshot write = %g usecs.\n", max_usec[3]);
+    printf("# snapshot raw bytes = %.0f\n", total_bytes[0]);
+    printf("# snapshot output bytes = %.0f\n", total_bytes[1]);
+  }
+}
+
+/** float to IEEE half, rounded to nearest even, saturated to the largest
+ * finite half */
+static uint16_t half_encode(float f) {
+  uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+  uint16_t sign = (x >> 16) & 0x8000;
+  int exp = (int)((x >> 23) & 0xff) - 127 + 15;
+  uint32_t mant = x & 0x7fffff;
+  if (exp >= 31) {
+    return sign | 0x7bff;
+  }
+  if (exp <= 0) {
+    // subnormal half
+    if (exp < -10) {
+      return sign;
+    }
+    mant |= 0x800000;
+    int shift = 14 - exp;
+    uint32_t half_mant = mant >> shift;
+    uint32_t rest = mant & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half_mant & 1))) {
+      half_mant++;
+    }
+    return sign | half_mant;
+  }
+  uint32_t half = ((uint32_t)exp << 10) | (mant >> 13);
+  uint32_t rest = mant & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+    half++; // may carry into the exponent, which is still a valid rounding
+  }
+  return sign | (half < 0x7c00 ? half : 0x7bff);
+}
+
+static float half_decode(uint16_t h) {
+  int exp = (h >> 10) & 0x1f;
+  int mant = h & 0x3ff;
+  float v = exp == 0 ? ldexpf(mant, -24) : ldexpf(mant | 0x400, exp - 25);
+  return (h & 0x8000) ? -v : v;
+}
+
+/** float to bfloat16, rounded to nearest even */
+static uint16_t bf16_encode(float f) {
+  uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+  return (x + 0x7fff + ((x >> 16) & 1)) >> 16;
+}
+
+static float bf16_decode(uint16_t h) {
+  uint32_t x = (uint32_t)h << 16;
+  float f;
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+/** decoded delta of a code, scaled back by 2^-k */
+static stencil_t halo_code_value(uint16_t code, int k) {
+  if (halo_codec == HALO_CODEC_FP16) {
+    return ldexpf(half_decode(code), -k);
+  }
+  return bf16_decode(code);
+}
+
+/** exchange of the halo message sent to neighbour d (left, right, up, down)
+ * through the codec: the deltas against the reference are coded on 16 bits,
+ * or the cells are sent as raw floats when the codes would leave an error
+ * above halo_codec_tolerance, which keeps the drift of the halos far below
+ * epsilon */
+static void halo_codec_exchange(int d) {
+  const int R = STENCIL_RADIUS;
+  // send and receive corners of the blocks, and their shape
+  const int send_x[4] = {R, local_size_x, 0, 0};
+  const int send_y[4] = {R, R, R, local_size_y};
+  const int recv_x[4] = {local_size_x + R, 0, 0, 0};
+  const int recv_y[4] = {R, R, local_size_y + R, 0};
+  const int dest[4] = {rank_left, rank_right, rank_up, rank_down};
+  const int source[4] = {rank_right, rank_left, rank_down, rank_up};
+  const int w = d < 2 ? R : LOCAL_STRIDE;
+  const int h = d < 2 ? local_size_y : R;
+  const int n = w * h;
+  stencil_t *ref = halo_ref_send[d];
+
+  // power of two scale bringing the largest delta just below 2^15, where
+  // fp16 keeps its full precision
+  int k = 0;
+  if (halo_codec == HALO_CODEC_FP16) {
+    float max_delta = 0.0;
+    for (int i = 0; i < n; i++) {
+      float delta =
+          fabsf(local_values[IND(send_x[d] + i % w, send_y[d] + i / w)] -
+                ref[i]);
+      max_delta = delta > max_delta ? delta : max_delta;
+    }
+    if (max_delta > 0.0) {
+      int e;
+      frexpf(max_delta, &e);
+      k = 15 - e;
+      k = k < -120 ? -120 : (k > 120 ? 120 : k);
+    }
+  }
+  double max_error = 0.0;
+  for (int i = 0; i < n; i++) {
+    stencil_t v = local_values[IND(send_x[d] + i % w, send_y[d] + i / w)];
+    stencil_t delta = v - ref[i];
+    uint16_t code = halo_codec == HALO_CODEC_FP16
+                        ? half_encode(ldexpf(delta, k))
+                        : bf16_encode(delta);
+    stencil_t error = fabsf(ref[i] + halo_code_value(code, k) - v);
+    max_error = error > max_error ? error : max_error;
+    halo_send_buf[1 + i] = code;
+  }
+  int count;
+  if (max_error <= halo_codec_tolerance) {
+    halo_send_buf[0] = (uint16_t)(int16_t)k;
+    for (int i = 0; i < n; i++) {
+      ref[i] += halo_code_value(halo_send_buf[1 + i], k);
+    }
+    count = n + 1;
+    halo_coded_messages += 1.0;
   } else {
-    printf("Results match perfectly.\n");
+    halo_send_buf[0] = HALO_RAW;
+    for (int i = 0; i < n; i++) {
+      ref[i] = local_values[IND(send_x[d] + i % w, send_y[d] + i / w)];
+    }
+    memcpy(&halo_send_buf[1], ref, n * sizeof(stencil_t));
+    count = 2 * n + 1;
+    halo_raw_messages += 1.0;
   }
-  free(test_values);
+  halo_sent_bytes += count * sizeof(uint16_t);
+  halo_float_bytes += n * sizeof(stencil_t);
 
-  stencil_free();
+  MPI_Sendrecv(halo_send_buf, count, MPI_UINT16_T, dest[d], 0, halo_recv_buf,
+               2 * n + 1, MPI_UINT16_T, source[d], 0, comm2d,
+               MPI_STATUS_IGNORE);
+  if (source[d] == MPI_PROC_NULL) {
+    return;
+  }
+  ref = halo_ref_recv[d];
+  if (halo_recv_buf[0] == HALO_RAW) {
+    memcpy(ref, &halo_recv_buf[1], n * sizeof(stencil_t));
+  } else {
+    int recv_k = (int16_t)halo_recv_buf[0];
+    for (int i = 0; i < n; i++) {
+      ref[i] += halo_code_value(halo_recv_buf[1 + i], recv_k);
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    local_values[IND(recv_x[d] + i % w, recv_y[d] + i / w)] = ref[i];
+  }
+}
+
+/** share of the halo messages coded and of the float bytes sent, on rank 0 */
+static void halo_codec_report() {
+  if (halo_codec == HALO_CODEC_NONE) {
+    return;
+  }
+  double local_counts[4] = {halo_coded_messages, halo_raw_messages,
+                            halo_sent_bytes, halo_float_bytes};
+  double counts[4];
+  MPI_Reduce(local_counts, counts, 4, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  if (rank == 0 && counts[0] + counts[1] > 0.0) {
+    printf("# halo codec = %s\n",
+           halo_codec == HALO_CODEC_FP16 ? "fp16" : "bf16");
+    printf("# halo coded messages = %.1f%%\n",
+           100.0 * counts[0] / (counts[0] + counts[1]));
+    printf("# halo bytes = %.1f%% of floats\n",
+           100.0 * counts[2] / counts[3]);
+  }
 }
 
 static void halo() {
 
 #pragma omp master
-  {
+  if (halo_codec != HALO_CODEC_NONE) {
+    for (int d = 0; d < 4; d++) {
+      double t = trace_now();
+      halo_codec_exchange(d);
+      trace_record(TRACE_HALO_LEFT + d, t);
+    }
+  } else {
 
-    MPI_Sendrecv(&local_values[IND(1, 1)], 1, halo_row, rank_up, 0,
-                 &local_values[IND(1, local_size_y + 1)], 1, halo_row,
-                 rank_down, 0, comm2d, MPI_STATUS_IGNORE);
+    // columns first, then full rows so that the corners follow
+    double t = trace_now();
+    MPI_Sendrecv(&local_values[IND(STENCIL_RADIUS, STENCIL_RADIUS)], 1,
+                 halo_column, rank_left, 0,
+                 &local_values[IND(local_size_x + STENCIL_RADIUS,
+                                   STENCIL_RADIUS)],
+                 1, halo_column, rank_right, 0, comm2d, MPI_STATUS_IGNORE);
+    trace_record(TRACE_HALO_LEFT, t);
 
-    MPI_Sendrecv(&local_values[IND(1, local_size_y)], 1, halo_row, rank_down, 0,
-                 &local_values[IND(1, 0)], 1, halo_row, rank_up, 0, comm2d,
-                 MPI_STATUS_IGNORE);
+    t = trace_now();
+    MPI_Sendrecv(&local_values[IND(local_size_x, STENCIL_RADIUS)], 1,
+                 halo_column, rank_right, 0,
+                 &local_values[IND(0, STENCIL_RADIUS)], 1, halo_column,
+                 rank_left, 0, comm2d, MPI_STATUS_IGNORE);
+    trace_record(TRACE_HALO_RIGHT, t);
 
-    MPI_Sendrecv(&local_values[IND(1, 1)], 1, halo_column, rank_left, 0,
-                 &local_values[IND(local_size_x + 1, 1)], 1, halo_column,
-                 rank_right, 0, comm2d, MPI_STATUS_IGNORE);
+    t = trace_now();
+    MPI_Sendrecv(&local_values[IND(0, STENCIL_RADIUS)], 1, halo_row, rank_up,
+                 0, &local_values[IND(0, local_size_y + STENCIL_RADIUS)], 1,
+                 halo_row, rank_down, 0, comm2d, MPI_STATUS_IGNORE);
+    trace_record(TRACE_HALO_UP, t);
 
-    MPI_Sendrecv(&local_values[IND(local_size_x, 1)], 1, halo_column,
-                 rank_right, 0, &local_values[IND(0, 1)], 1, halo_column,
-                 rank_left, 0, comm2d, MPI_STATUS_IGNORE);
+    t = trace_now();
+    MPI_Sendrecv(&local_values[IND(0, local_size_y)], 1, halo_row, rank_down,
+                 0, &local_values[IND(0, 0)], 1, halo_row, rank_up, 0, comm2d,
+                 MPI_STATUS_IGNORE);
+    trace_record(TRACE_HALO_DOWN, t);
   }
 #pragma omp barrier
 }
 
-static int stencil_step_hybrid(void) {
+/** gather whole lines on their owners, solve them and send them back */
+static void adi_solve(adi_sweep_t *sw) {
+  MPI_Alltoallv(adi_send, sw->send_counts, sw->send_displs, MPI_FLOAT,
+                adi_recv, sw->recv_counts, sw->recv_displs, MPI_FLOAT,
+                sw->comm);
+  const int m = sw->line_count[sw->me];
+#pragma omp parallel for
+  for (int l = 0; l < m; l += ADI_LINE_BLOCK) {
+    int l1 = l + ADI_LINE_BLOCK < m ? l + ADI_LINE_BLOCK : m;
+    thomas_batch(adi_recv, sw->n, m, l, l1, sw->cp, sw->inv,
+                 0.5 * alpha * adi_factor);
+  }
+  MPI_Alltoallv(adi_recv, sw->recv_counts, sw->recv_displs, MPI_FLOAT,
+                adi_send, sw->send_counts, sw->send_displs, MPI_FLOAT,
+                sw->comm);
+}
+
+/** Peaceman-Rachford ADI step of adi_factor explicit steps: implicit along x
+ * and explicit along y for half a step, then the other way round. Lines are
+ * transposed onto the ranks of their row or column of the grid, so that
+ * each solve runs over whole lines and across lines in the inner loop. */
+static int stencil_step_adi(void) {
   int convergence = 1;
 
   stencil_t *tmp = local_prev_values;
   local_prev_values = local_values;
   local_values = tmp;
 
-#pragma omp parallel for collapse(2) shared(local_values, local_prev_values)   \
-    reduction(& : convergence)
+  const stencil_t h = 0.5 * alpha * adi_factor;
+  const int left = grid_coord[0] == 0;
+  const int right = grid_coord[0] == grid_dim[0] - 1;
+  const int up = grid_coord[1] == 0;
+  const int down = grid_coord[1] == grid_dim[1] - 1;
+  adi_sweep_t *sw = &adi_sweep_x;
+
+  // x sweep: line y - 1, cell x - 1
+#pragma omp parallel for
   for (int y = 1; y < local_size_y + 1; y++) {
+    int j = sw->owner[y - 1];
+    stencil_t *line = &adi_send[sw->send_displs[j] + sw->slot[y - 1]];
     for (int x = 1; x < local_size_x + 1; x++) {
+      stencil_t rhs = local_prev_values[IND(x, y)] +
+                      h * (local_prev_values[IND(x, y - 1)] -
+                           2.0 * local_prev_values[IND(x, y)] +
+                           local_prev_values[IND(x, y + 1)]);
+      if (left && x == 1) {
+        rhs += h * local_prev_values[IND(0, y)];
+      }
+      if (right && x == local_size_x) {
+        rhs += h * local_prev_values[IND(local_size_x + 1, y)];
+      }
+      line[(x - 1) * sw->line_count[j]] = rhs;
+    }
+  }
+  adi_solve(sw);
+#pragma omp parallel for
+  for (int y = 1; y < local_size_y + 1; y++) {
+    int j = sw->owner[y - 1];
+    stencil_t *line = &adi_send[sw->send_displs[j] + sw->slot[y - 1]];
+    for (int x = 1; x < local_size_x + 1; x++) {
+      local_values[IND(x, y)] = line[(x - 1) * sw->line_count[j]];
+    }
+  }
+  halo();
+
+  // y sweep on the intermediate field: line x - 1, cell y - 1
+  sw = &adi_sweep_y;
+#pragma omp parallel for
+  for (int y = 1; y < local_size_y + 1; y++) {
+    for (int x = 1; x < local_size_x + 1; x++) {
+      int j = sw->owner[x - 1];
+      stencil_t rhs = local_values[IND(x, y)] +
+                      h * (local_values[IND(x - 1, y)] -
+                           2.0 * local_values[IND(x, y)] +
+                           local_values[IND(x + 1, y)]);
+      if (up && y == 1) {
+        rhs += h * local_prev_values[IND(x, 0)];
+      }
+      if (down && y == local_size_y) {
+        rhs += h * local_prev_values[IND(x, local_size_y + 1)];
+      }
+      adi_send[sw->send_displs[j] + (y - 1) * sw->line_count[j] +
+               sw->slot[x - 1]] = rhs;
+    }
+  }
+  adi_solve(sw);
+#pragma omp parallel for reduction(& : convergence)
+  for (int y = 1; y < local_size_y + 1; y++) {
+    for (int x = 1; x < local_size_x + 1; x++) {
+      int j = sw->owner[x - 1];
       local_values[IND(x, y)] =
-          alpha * (local_prev_values[IND(x - 1, y)] +
-                   local_prev_values[IND(x + 1, y)] +
-                   local_prev_values[IND(x, y - 1)] +
-                   local_prev_values[IND(x, y + 1)]) +
-          (1.0 - 4.0 * alpha) * local_prev_values[IND(x, y)];
+          adi_send[sw->send_displs[j] + (y - 1) * sw->line_count[j] +
+                   sw->slot[x - 1]];
       if (fabs(local_prev_values[IND(x, y)] - local_values[IND(x, y)]) >
           epsilon) {
         convergence = 0;
@@ -373,32 +1945,1324 @@ static int stencil_step_hybrid(void) {
   return convergence;
 }
 
-int main(int argc, char **argv) {
+/** bound the spectrum of J on the interior by its symbol at Dirichlet modes
+ * sampled from the slowest to the fastest, and restart the recurrence */
+static void chebyshev_reset(void) {
+  const int n[2] = {size_x - 2 * STENCIL_RADIUS, size_y - 2 * STENCIL_RADIUS};
+  chebyshev_bounds[0] = INFINITY;
+  chebyshev_bounds[1] = -INFINITY;
+  for (int i = 0; i < CHEBYSHEV_SAMPLES; i++) {
+    for (int j = 0; j < CHEBYSHEV_SAMPLES; j++) {
+      int k[2] = {1 + i * (n[0] - 1) / (CHEBYSHEV_SAMPLES - 1),
+                  1 + j * (n[1] - 1) / (CHEBYSHEV_SAMPLES - 1)};
+      double t[2] = {M_PI * k[0] / (n[0] + 1), M_PI * k[1] / (n[1] + 1)};
+      double g = STENCIL_SYMBOL(t, alpha);
+      chebyshev_bounds[0] = g < chebyshev_bounds[0] ? g : chebyshev_bounds[0];
+      chebyshev_bounds[1] = g > chebyshev_bounds[1] ? g : chebyshev_bounds[1];
+    }
+  }
+  chebyshev_rho = 0.0;
+}
 
-  MPI_Init(&argc, &argv);
-  setup_process();
+/** weights of the next step of the Chebyshev recurrence for I - J, whose
+ * spectrum lies in theta +- delta */
+static void chebyshev_next(void) {
+  const double theta = 1.0 - (chebyshev_bounds[0] + chebyshev_bounds[1]) / 2;
+  double delta = (chebyshev_bounds[1] - chebyshev_bounds[0]) / 2;
+  if (delta < 1e-12) {
+    delta = 1e-12;
+  }
+  const double sigma = theta / delta;
+  if (chebyshev_rho == 0.0) {
+    chebyshev_rho = 1.0 / sigma;
+    chebyshev_w[0] = 0.0;
+    chebyshev_w[1] = 1.0 / theta;
+  } else {
+    double rho = 1.0 / (2.0 * sigma - chebyshev_rho);
+    chebyshev_w[0] = rho * chebyshev_rho;
+    chebyshev_w[1] = 2.0 * rho / delta;
+    chebyshev_rho = rho;
+  }
+}
 
-  if (setup_option(argc, argv) != 0) {
-    return EXIT_FAILURE;
+/** compute one tile of a Chebyshev step, return 1 if all of its cells have
+ * converged; local_values still holds the field of the step before
+ * local_prev_values */
+static int stencil_tile_chebyshev(int tile) {
+  int convergence = 1;
+  const stencil_t w0 = chebyshev_w[0], w1 = chebyshev_w[1];
+  int x0 = STENCIL_RADIUS + (tile % tile_count_x) * tile_x;
+  int y0 = STENCIL_RADIUS + (tile / tile_count_x) * tile_y;
+  int x1 = x0 + tile_x < local_size_x + STENCIL_RADIUS
+               ? x0 + tile_x
+               : local_size_x + STENCIL_RADIUS;
+  int y1 = y0 + tile_y < local_size_y + STENCIL_RADIUS
+               ? y0 + tile_y
+               : local_size_y + STENCIL_RADIUS;
+  for (int y = y0; y < y1; y++) {
+    for (int i = row_runs[y - STENCIL_RADIUS];
+         i < row_runs[y - STENCIL_RADIUS + 1]; i++) {
+      int start = runs[2 * i] > x0 ? runs[2 * i] : x0;
+      int end = runs[2 * i + 1] < x1 ? runs[2 * i + 1] : x1;
+      for (int x = start; x < end; x++) {
+        stencil_t cur = local_prev_values[IND(x, y)];
+        stencil_t change = STENCIL_APPLY(&local_prev_values[IND(x, y)],
+                                         LOCAL_STRIDE, alpha) -
+                           cur;
+        local_values[IND(x, y)] =
+            cur + w0 * (cur - local_values[IND(x, y)]) + w1 * change;
+        if (fabs(change) > epsilon) {
+          convergence = 0;
+        }
+      }
+    }
   }
+  return convergence;
+}
 
-  setup_2D_topology();
-  allocate_local_stencil();
+/** compute one tile, return 1 if all of its cells have converged */
+static int stencil_tile(int tile) {
+  int convergence = 1;
+  int x0 = STENCIL_RADIUS + (tile % tile_count_x) * tile_x;
+  int y0 = STENCIL_RADIUS + (tile / tile_count_x) * tile_y;
+  int x1 = x0 + tile_x < local_size_x + STENCIL_RADIUS
+               ? x0 + tile_x
+               : local_size_x + STENCIL_RADIUS;
+  int y1 = y0 + tile_y < local_size_y + STENCIL_RADIUS
+               ? y0 + tile_y
+               : local_size_y + STENCIL_RADIUS;
+  for (int y = y0; y < y1; y++) {
+    for (int i = row_runs[y - STENCIL_RADIUS];
+         i < row_runs[y - STENCIL_RADIUS + 1]; i++) {
+      // the run clipped to the tile
+      int start = runs[2 * i] > x0 ? runs[2 * i] : x0;
+      int end = runs[2 * i + 1] < x1 ? runs[2 * i + 1] : x1;
+      for (int x = start; x < end; x++) {
+        local_values[IND(x, y)] =
+            STENCIL_APPLY(&local_prev_values[IND(x, y)], LOCAL_STRIDE, alpha);
+        if (fabs(local_prev_values[IND(x, y)] - local_values[IND(x, y)]) >
+            epsilon) {
+          convergence = 0;
+        }
+      }
+    }
+  }
+  return convergence;
+}
+
+/** explicit step of the stencil, return 1 if the tile has converged */
+static int stencil_step_explicit(void) {
+  int convergence = 1;
+
+  stencil_t *tmp = local_prev_values;
+  local_prev_values = local_values;
+  local_values = tmp;
+  if (chebyshev_mode) {
+    chebyshev_next();
+  }
+
+  tile_setup(local_size_x, local_size_y);
+#pragma omp parallel reduction(& : convergence)
+  {
+    tile_deque_reset();
+#pragma omp barrier
+    double t = trace_now();
+    int tile;
+    while ((tile = tile_next()) >= 0) {
+      convergence &= chebyshev_mode ? stencil_tile_chebyshev(tile)
+                                    : stencil_tile(tile);
+    }
+    trace_record(TRACE_COMPUTE, t);
+  }
+  halo();
+  return convergence;
+}
+
+/** grow the strips and windows to the current tiles and thread count */
+static void inplace_reserve(void) {
+  size_t needed[3];
+  needed[0] = (size_t)tile_count_y * 2 * STENCIL_RADIUS * LOCAL_STRIDE;
+  needed[1] = (size_t)tile_count_x * (local_size_y + 2 * STENCIL_RADIUS) * 2 *
+              STENCIL_RADIUS;
+  inplace_window_cells = 2 * INPLACE_ROWS * (tile_x + 2 * STENCIL_RADIUS);
+  needed[2] = (size_t)omp_get_max_threads() * inplace_window_cells;
+  stencil_t **buffers[3] = {&inplace_rows, &inplace_cols, &inplace_windows};
+  for (int i = 0; i < 3; i++) {
+    if (needed[i] > inplace_reserved[i]) {
+      free(*buffers[i]);
+      *buffers[i] = malloc(needed[i] * sizeof(stencil_t));
+      inplace_reserved[i] = needed[i];
+    }
+  }
+}
+
+/** save the old cells that the tiles read from their neighbours before any
+ * tile is updated in place: the rows above and below each band of tiles and
+ * the columns left and right of each column of tiles */
+static void inplace_save_strips(void) {
+  const size_t strip_size = STENCIL_RADIUS * LOCAL_STRIDE * sizeof(stencil_t);
+#pragma omp for
+  for (int band = 0; band < tile_count_y; band++) {
+    int y0 = STENCIL_RADIUS + band * tile_y;
+    int y1 = y0 + tile_y < local_size_y + STENCIL_RADIUS
+                 ? y0 + tile_y
+                 : local_size_y + STENCIL_RADIUS;
+    stencil_t *strip = &inplace_rows[band * 2 * STENCIL_RADIUS * LOCAL_STRIDE];
+    memcpy(strip, &local_values[IND(0, y0 - STENCIL_RADIUS)], strip_size);
+    memcpy(strip + STENCIL_RADIUS * LOCAL_STRIDE, &local_values[IND(0, y1)],
+           strip_size);
+  }
+#pragma omp for
+  for (int y = STENCIL_RADIUS; y < local_size_y + STENCIL_RADIUS; y++) {
+    for (int column = 0; column < tile_count_x; column++) {
+      int x0 = STENCIL_RADIUS + column * tile_x;
+      int x1 = x0 + tile_x < local_size_x + STENCIL_RADIUS
+                   ? x0 + tile_x
+                   : local_size_x + STENCIL_RADIUS;
+      stencil_t *strip =
+          &inplace_cols[(column * (local_size_y + 2 * STENCIL_RADIUS) + y) *
+                        2 * STENCIL_RADIUS];
+      for (int k = 0; k < STENCIL_RADIUS; k++) {
+        strip[k] = local_values[IND(x0 - STENCIL_RADIUS + k, y)];
+        strip[STENCIL_RADIUS + k] = local_values[IND(x1 + k, y)];
+      }
+    }
+  }
+}
+
+/** compute one tile in place, return 1 if all of its cells have converged,
+ * the old cells around it taken from the saved strips */
+static int stencil_tile_inplace(int tile) {
+  int band = tile / tile_count_x;
+  int column = tile % tile_count_x;
+  int x0 = STENCIL_RADIUS + column * tile_x;
+  int y0 = STENCIL_RADIUS + band * tile_y;
+  int x1 = x0 + tile_x < local_size_x + STENCIL_RADIUS
+               ? x0 + tile_x
+               : local_size_x + STENCIL_RADIUS;
+  int y1 = y0 + tile_y < local_size_y + STENCIL_RADIUS
+               ? y0 + tile_y
+               : local_size_y + STENCIL_RADIUS;
+  const stencil_t *above =
+      &inplace_rows[band * 2 * STENCIL_RADIUS * LOCAL_STRIDE + x0 -
+                    STENCIL_RADIUS];
+  return inplace_tile(
+      local_values, LOCAL_STRIDE, x0, x1, y0, y1, above,
+      above + STENCIL_RADIUS * LOCAL_STRIDE,
+      &inplace_cols[column * (local_size_y + 2 * STENCIL_RADIUS) * 2 *
+                    STENCIL_RADIUS],
+      &inplace_windows[omp_get_thread_num() * inplace_window_cells], row_runs,
+      runs, alpha, epsilon);
+}
+
+/** explicit step updating the local field in place, tile by tile, return 1
+ * if the tile has converged */
+static int stencil_step_inplace(void) {
+  int convergence = 1;
+  tile_setup(local_size_x, local_size_y);
+  inplace_reserve();
+#pragma omp parallel reduction(& : convergence)
+  {
+    double t = trace_now();
+    inplace_save_strips();
+    tile_deque_reset();
+#pragma omp barrier
+    int tile;
+    while ((tile = tile_next()) >= 0) {
+      convergence &= stencil_tile_inplace(tile);
+    }
+    trace_record(TRACE_COMPUTE, t);
+  }
+  halo();
+  return convergence;
+}
+
+static int stencil_step_hybrid(void) {
+  if (adi_factor > 0.0) {
+    return stencil_step_adi();
+  }
+  if (inplace_mode) {
+    return stencil_step_inplace();
+  }
+  return stencil_step_explicit();
+}
+
+/** overwrite the border cells of a block of nx x ny cells at (start_x,
+ * start_y) in the grid on the sides given with -B; left and right win at the
+ * corners, as in the initial condition */
+static void boundary_apply_block(stencil_t *block, int stride, int start_x,
+                                 int start_y, int nx, int ny) {
+  for (int y = 0; y < ny; y++) {
+    for (int x = 0; x < nx; x++) {
+      int gx = start_x + x;
+      int gy = start_y + y;
+      int side = -1;
+      if (gy < STENCIL_RADIUS) {
+        side = 0;
+      } else if (gy >= size_y - STENCIL_RADIUS) {
+        side = 1;
+      }
+      if (gx < STENCIL_RADIUS) {
+        side = 2;
+      } else if (gx >= size_x - STENCIL_RADIUS) {
+        side = 3;
+      }
+      if (side >= 0 && boundary_set[side]) {
+        block[x + stride * y] = boundary_value[side];
+      }
+    }
+  }
+}
+
+/** apply the -B sides to the local tile and its halo */
+static void boundary_apply(stencil_t *tile) {
+  boundary_apply_block(tile, LOCAL_STRIDE, local_x0, local_y0,
+                       local_size_x + 2 * STENCIL_RADIUS,
+                       local_size_y + 2 * STENCIL_RADIUS);
+}
+
+/** path of the saved tile of this rank */
+static void warm_path(char *path, size_t len, const char *prefix) {
+  snprintf(path, len, "%s_%d.tile", prefix, rank);
+}
+
+/** header describing the current tile */
+static warm_header_t warm_header() {
+  warm_header_t header = {size_x, size_y, STENCIL_RADIUS,
+                          {grid_dim[0], grid_dim[1]},
+                          {grid_coord[0], grid_coord[1]}};
+  return header;
+}
+
+/** replace the local fields with the tiles saved by a previous run with the
+ * same size and decomposition, return 1 if every rank could load its tile */
+static int warm_load() {
+  char path[300];
+  warm_path(path, sizeof(path), warm_read_prefix);
+  warm_header_t expected = warm_header(), header;
+  int loaded = 0;
+  FILE *in = fopen(path, "rb");
+  if (in != NULL) {
+    loaded = fread(&header, sizeof(header), 1, in) == 1 &&
+             memcmp(&header, &expected, sizeof(header)) == 0 &&
+             fread(local_values, sizeof(stencil_t), LOCAL_CELLS, in) ==
+                 (size_t)LOCAL_CELLS;
+    fclose(in);
+  }
+  int all_loaded;
+  MPI_Allreduce(&loaded, &all_loaded, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+  if (!loaded) {
+    fprintf(stderr, "rank %d: cannot load %s for this grid\n", rank, path);
+  }
+  return all_loaded;
+}
+
+/** start from the saved solution if asked to and if it fits the grid, then
+ * apply the boundary overrides */
+static void warm_start() {
+  if (warm_read_prefix[0] != '\0') {
+    if (warm_load()) {
+      if (rank == 0) {
+        printf("# warm start = %s\n", warm_read_prefix);
+      }
+    } else {
+      if (rank == 0) {
+        printf("# warm start = none, cold start\n");
+      }
+      warm_read_prefix[0] = '\0';
+      distribute_stencils();
+    }
+  }
+  boundary_apply(local_values);
+  if (local_prev_values != NULL) {
+    memcpy(local_prev_values, local_values, LOCAL_CELLS * sizeof(stencil_t));
+  }
+}
+
+/** save the local fields, halo included, for a later warm start */
+static void warm_save() {
+  if (warm_write_prefix[0] == '\0') {
+    return;
+  }
+  char path[300];
+  warm_path(path, sizeof(path), warm_write_prefix);
+  warm_header_t header = warm_header();
+  FILE *out = fopen(path, "wb");
+  if (out == NULL ||
+      fwrite(&header, sizeof(header), 1, out) != 1 ||
+      fwrite(local_values, sizeof(stencil_t), LOCAL_CELLS, out) !=
+          (size_t)LOCAL_CELLS) {
+    fprintf(stderr, "rank %d: cannot save %s\n", rank, path);
+  }
+  if (out != NULL) {
+    fclose(out);
+  }
+}
+
+/** init the local tile and its halo from the global initial condition */
+static void local_stencil_init(stencil_t *tile) {
+  int start_x = local_x0;
+  int start_y = local_y0;
+  for (int y = 0; y < local_size_y + 2 * STENCIL_RADIUS; y++) {
+    for (int x = 0; x < local_size_x + 2 * STENCIL_RADIUS; x++) {
+      int gx = start_x + x;
+      int gy = start_y + y;
+      stencil_t v = 0.0;
+      if (gy < STENCIL_RADIUS) {
+        v = gx;
+      } else if (gy >= size_y - STENCIL_RADIUS) {
+        v = size_x - 1 - gx;
+      }
+      if (gx < STENCIL_RADIUS) {
+        v = gy;
+      } else if (gx >= size_x - STENCIL_RADIUS) {
+        v = size_y - 1 - gy;
+      }
+      tile[IND(x, y)] = v;
+    }
+  }
+  boundary_apply(tile);
+}
+
+/** reference step of test(): plain loops over the rows shared by the
+ * threads, then the blocking halo exchange; return 1 if the tile has
+ * converged */
+static int stencil_step_ref(void) {
+  int convergence = 1;
+
+  stencil_t *tmp = local_prev_values;
+  local_prev_values = local_values;
+  local_values = tmp;
+
+#pragma omp parallel for reduction(& : convergence)
+  for (int y = STENCIL_RADIUS; y < local_size_y + STENCIL_RADIUS; y++) {
+    for (int i = row_runs[y - STENCIL_RADIUS];
+         i < row_runs[y - STENCIL_RADIUS + 1]; i++) {
+      for (int x = runs[2 * i]; x < runs[2 * i + 1]; x++) {
+        local_values[IND(x, y)] =
+            STENCIL_APPLY(&local_prev_values[IND(x, y)], LOCAL_STRIDE, alpha);
+        if (fabs(local_prev_values[IND(x, y)] - local_values[IND(x, y)]) >
+            epsilon) {
+          convergence = 0;
+        }
+      }
+    }
+  }
+  halo();
+  return convergence;
+}
+
+/** reference Chebyshev step of test(): local_values holds the field of the
+ * step before, as in the solver */
+static int stencil_step_ref_chebyshev(void) {
+  int convergence = 1;
+
+  stencil_t *tmp = local_prev_values;
+  local_prev_values = local_values;
+  local_values = tmp;
+  chebyshev_next();
+  const stencil_t w0 = chebyshev_w[0], w1 = chebyshev_w[1];
+
+#pragma omp parallel for reduction(& : convergence)
+  for (int y = STENCIL_RADIUS; y < local_size_y + STENCIL_RADIUS; y++) {
+    for (int i = row_runs[y - STENCIL_RADIUS];
+         i < row_runs[y - STENCIL_RADIUS + 1]; i++) {
+      for (int x = runs[2 * i]; x < runs[2 * i + 1]; x++) {
+        stencil_t cur = local_prev_values[IND(x, y)];
+        stencil_t change = STENCIL_APPLY(&local_prev_values[IND(x, y)],
+                                         LOCAL_STRIDE, alpha) -
+                           cur;
+        local_values[IND(x, y)] =
+            cur + w0 * (cur - local_values[IND(x, y)]) + w1 * change;
+        if (fabs(change) > epsilon) {
+          convergence = 0;
+        }
+      }
+    }
+  }
+  halo();
+  return convergence;
+}
+
+/** interior rectangle {x0, y0, x1, y1} of rank r under the cuts cx, cy */
+static void tile_rect(const int *cx, const int *cy, int r, int rect[4]) {
+  int coords[2];
+  MPI_Cart_coords(comm2d, r, 2, coords);
+  rect[0] = cx[coords[0]];
+  rect[1] = cy[coords[1]];
+  rect[2] = cx[coords[0] + 1];
+  rect[3] = cy[coords[1] + 1];
+}
+
+/** intersection of the rectangles a and b, return its cell count */
+static int rect_overlap(const int a[4], const int b[4], int out[4]) {
+  out[0] = a[0] > b[0] ? a[0] : b[0];
+  out[1] = a[1] > b[1] ? a[1] : b[1];
+  out[2] = a[2] < b[2] ? a[2] : b[2];
+  out[3] = a[3] < b[3] ? a[3] : b[3];
+  if (out[0] >= out[2] || out[1] >= out[3]) {
+    return 0;
+  }
+  return (out[2] - out[0]) * (out[3] - out[1]);
+}
+
+/** move the interior of old_field, cut by old_cx and old_cy, to new_field,
+ * cut by new_cx and new_cy and laid out as the current tile: every rank
+ * sends each other rank the part of its old tile that lands in the other's
+ * new one, in one Alltoallv */
+static void migrate_field(const stencil_t *old_field, stencil_t *new_field,
+                          const int *old_cx, const int *old_cy,
+                          const int *new_cx, const int *new_cy) {
+  int *counts = calloc(4 * size, sizeof(int)); // send, displs, recv, displs
+  int old_tile[4], new_tile[4], other[4], part[4];
+  tile_rect(old_cx, old_cy, rank, old_tile);
+  tile_rect(new_cx, new_cy, rank, new_tile);
+  const int old_stride = old_tile[2] - old_tile[0] + 2 * STENCIL_RADIUS;
+  int send_total = 0, recv_total = 0;
+  for (int r = 0; r < size; r++) {
+    tile_rect(new_cx, new_cy, r, other);
+    counts[r] = rect_overlap(old_tile, other, part);
+    counts[size + r] = send_total;
+    send_total += counts[r];
+    tile_rect(old_cx, old_cy, r, other);
+    counts[2 * size + r] = rect_overlap(other, new_tile, part);
+    counts[3 * size + r] = recv_total;
+    recv_total += counts[2 * size + r];
+  }
+  stencil_t *send = malloc((send_total + 1) * sizeof(stencil_t));
+  stencil_t *recv = malloc((recv_total + 1) * sizeof(stencil_t));
+  for (int r = 0; r < size; r++) {
+    tile_rect(new_cx, new_cy, r, other);
+    if (rect_overlap(old_tile, other, part) > 0) {
+      copy_block(&send[counts[size + r]], part[2] - part[0],
+                 &old_field[part[0] - old_tile[0] + STENCIL_RADIUS +
+                            old_stride *
+                                (part[1] - old_tile[1] + STENCIL_RADIUS)],
+                 old_stride, part[2] - part[0], part[3] - part[1]);
+    }
+  }
+  MPI_Alltoallv(send, counts, &counts[size], MPI_FLOAT, recv,
+                &counts[2 * size], &counts[3 * size], MPI_FLOAT, comm2d);
+  for (int r = 0; r < size; r++) {
+    tile_rect(old_cx, old_cy, r, other);
+    if (rect_overlap(other, new_tile, part) > 0) {
+      copy_block(&new_field[IND(part[0] - new_tile[0] + STENCIL_RADIUS,
+                                part[1] - new_tile[1] + STENCIL_RADIUS)],
+                 LOCAL_STRIDE, &recv[counts[3 * size + r]],
+                 part[2] - part[0], part[2] - part[0], part[3] - part[1]);
+    }
+  }
+  free(send);
+  free(recv);
+  free(counts);
+}
+
+/** cuts of the reference of test(): the inner ones in the middle of the
+ * parts of cut, the outer ones on the edges of the n interior lines, every
+ * part at least STENCIL_RADIUS lines wide */
+static void test_cuts(int *ref, const int *cut, int parts, int n) {
+  ref[0] = 0;
+  for (int c = 1; c < parts; c++) {
+    ref[c] = (cut[c - 1] + cut[c]) / 2;
+  }
+  ref[parts] = n;
+  for (int c = 1; c < parts; c++) {
+    if (ref[c] < ref[c - 1] + STENCIL_RADIUS) {
+      ref[c] = ref[c - 1] + STENCIL_RADIUS;
+    }
+  }
+  for (int c = parts - 1; c > 0; c--) {
+    if (ref[c] > ref[c + 1] - STENCIL_RADIUS) {
+      ref[c] = ref[c + 1] - STENCIL_RADIUS;
+    }
+  }
+}
+
+/** move the local tile to the cuts cx and cy, with its halo types and runs */
+static void cuts_apply(const int *cx, const int *cy) {
+  release_halo_type();
+  local_x0 = cx[grid_coord[0]];
+  local_y0 = cy[grid_coord[1]];
+  local_size_x = cx[grid_coord[0] + 1] - local_x0;
+  local_size_y = cy[grid_coord[1] + 1] - local_y0;
+  create_halo_type();
+  free(row_runs);
+  free(runs);
+  setup_runs();
+}
+
+/** check the result against a reference recomputed in parallel on other
+ * tiles and print a summary on rank 0. The reference cuts fall in the middle
+ * of the tiles of the solver and cover the whole interior, so neither a tile
+ * or halo error of the solver nor cells it leaves to no rank repeat in the
+ * reference; the result is moved to the reference tiles and every rank
+ * compares its own. */
+static void test(int steps) {
+  // residual of the result: largest change one more step would make
+  double residual = 0.0;
+  double magnitude = 0.0; // largest value, for the rounding tolerance
+#pragma omp parallel for reduction(max : residual, magnitude)
+  for (int y = STENCIL_RADIUS; y < local_size_y + STENCIL_RADIUS; y++) {
+    for (int i = row_runs[y - STENCIL_RADIUS];
+         i < row_runs[y - STENCIL_RADIUS + 1]; i++) {
+      for (int x = runs[2 * i]; x < runs[2 * i + 1]; x++) {
+        // rounded as the step stores it
+        stencil_t next =
+            STENCIL_APPLY(&local_values[IND(x, y)], LOCAL_STRIDE, alpha);
+        double change = fabs(next - local_values[IND(x, y)]);
+        if (change > residual) {
+          residual = change;
+        }
+        if (fabs(next) > magnitude) {
+          magnitude = fabs(next);
+        }
+      }
+    }
+  }
+  double local_max[2] = {residual, magnitude}, global_max[2];
+  MPI_Reduce(local_max, global_max, 2, MPI_DOUBLE, MPI_MAX, 0,
+             MPI_COMM_WORLD);
+
+  // ADI and warm starts stop at another distance from the steady state than
+  // the explicit reference from a cold start, so only the residual of the
+  // result is checked, up to the rounding of the stored values
+  if (adi_factor > 0.0 || warm_read_prefix[0] != '\0') {
+    if (rank == 0) {
+      const double tolerance = epsilon + 4.0 * FLT_EPSILON * global_max[1];
+      printf("Test mode\n");
+      printf("# verify residual = %g, tolerance = %g\n", global_max[0],
+             tolerance);
+      if (global_max[0] > tolerance) {
+        printf("Results do not match!\n");
+      } else {
+        printf("Results match perfectly.\n");
+      }
+    }
+    return;
+  }
+
+  // the reference runs on its own tiles with plain halos
+  int *cuts = malloc(2 * (grid_dim[0] + grid_dim[1] + 2) * sizeof(int));
+  int *old_cx = cuts, *old_cy = old_cx + grid_dim[0] + 1;
+  int *ref_cx = old_cy + grid_dim[1] + 1, *ref_cy = ref_cx + grid_dim[0] + 1;
+  for (int c = 0; c <= grid_dim[0]; c++) {
+    old_cx[c] = c * local_size_x;
+  }
+  for (int c = 0; c <= grid_dim[1]; c++) {
+    old_cy[c] = c * local_size_y;
+  }
+  test_cuts(ref_cx, old_cx, grid_dim[0], size_x - 2 * STENCIL_RADIUS);
+  test_cuts(ref_cy, old_cy, grid_dim[1], size_y - 2 * STENCIL_RADIUS);
+  stencil_t *solver_fields[2] = {local_values, local_prev_values};
+  release_halo_type();
+  halo_codec = HALO_CODEC_NONE;
   create_halo_type();
+  cuts_apply(ref_cx, ref_cy);
+  stencil_t *result = malloc(LOCAL_CELLS * sizeof(stencil_t));
+  local_stencil_init(result);
+  migrate_field(solver_fields[0], result, old_cx, old_cy, ref_cx, ref_cy);
+
+  local_values = malloc(LOCAL_CELLS * sizeof(stencil_t));
+  local_prev_values = malloc(LOCAL_CELLS * sizeof(stencil_t));
+  local_stencil_init(local_values);
+  memcpy(local_prev_values, local_values, LOCAL_CELLS * sizeof(stencil_t));
+  // Chebyshev steps are checked against plain Chebyshev steps, which keep the
+  // input of the converged step as the solver does
+  if (chebyshev_mode) {
+    chebyshev_reset();
+  }
+  int s;
+  int global_convergence = 0;
+  for (s = 0; s < stencil_max_steps; s++) {
+    int local_convergence = chebyshev_mode ? stencil_step_ref_chebyshev()
+                                           : stencil_step_ref();
+    MPI_Allreduce(&local_convergence, &global_convergence, 1, MPI_INT,
+                  MPI_LAND, MPI_COMM_WORLD);
+    if (global_convergence) {
+      if (chebyshev_mode) {
+        stencil_t *tmp = local_prev_values;
+        local_prev_values = local_values;
+        local_values = tmp;
+      }
+      break;
+    }
+  }
+
+  // per rank: mismatch count, max error and its global coordinates
+  double local_stats[4] = {0.0, -1.0, 0.0, 0.0};
+  for (int y = STENCIL_RADIUS; y < local_size_y + STENCIL_RADIUS; y++) {
+    for (int x = STENCIL_RADIUS; x < local_size_x + STENCIL_RADIUS; x++) {
+      double error = fabs(local_values[IND(x, y)] - result[IND(x, y)]);
+      if (error > epsilon) {
+        local_stats[0] += 1.0;
+      }
+      if (error > local_stats[1]) {
+        local_stats[1] = error;
+        local_stats[2] = local_x0 + x;
+        local_stats[3] = local_y0 + y;
+      }
+    }
+  }
+  double *stats = NULL;
+  if (rank == 0) {
+    stats = malloc(4 * size * sizeof(double));
+  }
+  MPI_Gather(local_stats, 4, MPI_DOUBLE, stats, 4, MPI_DOUBLE, 0, comm2d);
+
+  if (rank == 0) {
+    double mismatches = 0.0;
+    int worst = 0;
+    for (int r = 0; r < size; r++) {
+      mismatches += stats[4 * r];
+      if (stats[4 * r + 1] > stats[4 * worst + 1]) {
+        worst = r;
+      }
+    }
+    printf("Test mode\n");
+    printf("# verify steps = %d, reference steps = %d\n", steps, s);
+    printf("# verify mismatches = %.0f / %d cells\n", mismatches,
+           (size_x - 2 * STENCIL_RADIUS) * (size_y - 2 * STENCIL_RADIUS));
+    printf("# verify max error = %g at (%.0f, %.0f)\n", stats[4 * worst + 1],
+           stats[4 * worst + 2], stats[4 * worst + 3]);
+    printf("# verify residual = %g\n", global_max[0]);
+    if (mismatches > 0.0 || steps != s) {
+      printf("Results do not match!\n");
+    } else {
+      printf("Results match perfectly.\n");
+    }
+    free(stats);
+  }
+
+  // back to the tiles of the solver
+  free(local_values);
+  free(local_prev_values);
+  free(result);
+  local_values = solver_fields[0];
+  local_prev_values = solver_fields[1];
+  cuts_apply(old_cx, old_cy);
+  free(cuts);
+}
+
+/** path of the wisdom file, overridden by $STENCIL_WISDOM */
+static const char *wisdom_path(void) {
+  const char *path = getenv("STENCIL_WISDOM");
+  return path != NULL ? path : "stencil.wisdom";
+}
+
+/** find the configuration stored for key, return 0 if there is none */
+static int wisdom_load(const char *key, char *config, size_t len) {
+  FILE *file = fopen(wisdom_path(), "r");
+  if (file == NULL) {
+    return 0;
+  }
+  char line[512];
+  size_t key_len = strlen(key);
+  int found = 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (strncmp(line, key, key_len) == 0 && line[key_len] == ' ') {
+      line[strcspn(line, "\n")] = '\0';
+      snprintf(config, len, "%s", &line[key_len + 1]);
+      found = 1;
+    }
+  }
+  fclose(file);
+  return found;
+}
+
+/** replace the configuration stored for key in the wisdom file */
+static void wisdom_store(const char *key, const char *config) {
+  char tmp_path[512];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", wisdom_path());
+  FILE *out = fopen(tmp_path, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Cannot write wisdom file %s\n", tmp_path);
+    return;
+  }
+  FILE *in = fopen(wisdom_path(), "r");
+  if (in != NULL) {
+    char line[512];
+    size_t key_len = strlen(key);
+    while (fgets(line, sizeof(line), in) != NULL) {
+      if (!(strncmp(line, key, key_len) == 0 && line[key_len] == ' ')) {
+        fputs(line, out);
+      }
+    }
+    fclose(in);
+  }
+  fprintf(out, "%s %s\n", key, config);
+  fclose(out);
+  rename(tmp_path, wisdom_path());
+}
+
+/** wisdom key of this run: binary, grid size, stencil and machine */
+static void wisdom_key(char *key, size_t len) {
+  char host[64];
+  gethostname(host, sizeof(host));
+  host[sizeof(host) - 1] = '\0';
+  snprintf(key, len,
+           "stencil_hybrid size=%d stencil=%s host=%s ranks=%d procs=%d",
+           size_x, STENCIL_NAME, host, size, omp_get_num_procs());
+}
 
+/** time a few steps from the initial field, return the slowest usecs/step */
+static double autotune_trial() {
+  distribute_stencils();
+  MPI_Barrier(MPI_COMM_WORLD);
   struct timespec t1, t2;
   clock_gettime(CLOCK_MONOTONIC, &t1);
-  distribute_stencils();
   int s;
   int global_convergence = 0;
-  for (s = 0; s < stencil_max_steps; s++) {
+  for (s = 0; s < autotune_steps && !global_convergence; s++) {
     int local_convergence = stencil_step_hybrid();
     MPI_Allreduce(&local_convergence, &global_convergence, 1, MPI_INT, MPI_LAND,
                   MPI_COMM_WORLD);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t2);
+  double usec = elapsed_usec(&t1, &t2) / s;
+  double max_usec;
+  MPI_Allreduce(&usec, &max_usec, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  return max_usec;
+}
+
+/** try every valid grid shape and thread count, keep and store the fastest */
+static void autotune() {
+  int max_threads = omp_get_max_threads();
+  double best_usec = 0.0;
+  int best_dim[2] = {0, 0};
+  int best_threads = max_threads;
+  int best_tile[2] = {tile_x, tile_y};
+  for (int p = 1; p <= size; p++) {
+    if (size % p != 0 || (size_x - 2 * STENCIL_RADIUS) % p != 0 ||
+        (size_y - 2 * STENCIL_RADIUS) % (size / p) != 0) {
+      continue;
+    }
+    tuned_dim[0] = p;
+    tuned_dim[1] = size / p;
+    setup_2D_topology(MPI_COMM_WORLD);
+    allocate_local_stencil();
+    create_halo_type();
+    for (int t = 1;; t = 2 * t < max_threads ? 2 * t : max_threads) {
+      for (int i = 0; i < autotune_tile_count; i++) {
+        omp_set_num_threads(t);
+        tile_x = autotune_tiles[i][0];
+        tile_y = autotune_tiles[i][1];
+        double usec = autotune_trial();
+        if (rank == 0) {
+          printf("# trial dims = %dx%d threads = %d tile = %dx%d: %g "
+                 "usecs/step\n",
+                 p, size / p, t, tile_x, tile_y, usec);
+        }
+        if (best_usec == 0.0 || usec < best_usec) {
+          best_usec = usec;
+          best_dim[0] = p;
+          best_dim[1] = size / p;
+          best_threads = t;
+          best_tile[0] = autotune_tiles[i][0];
+          best_tile[1] = autotune_tiles[i][1];
+        }
+      }
+      if (t >= max_threads) {
+        break;
+      }
+    }
+    release_2D_topology();
+  }
+  tuned_dim[0] = best_dim[0];
+  tuned_dim[1] = best_dim[1];
+  tuned_threads = best_threads;
+  omp_set_num_threads(tuned_threads);
+  tile_x = best_tile[0];
+  tile_y = best_tile[1];
+
+  if (rank == 0 && best_usec > 0.0) {
+    char key[256], config[256];
+    wisdom_key(key, sizeof(key));
+    snprintf(config, sizeof(config),
+             "threads=%d dims=%dx%d tile=%dx%d usec=%g", tuned_threads,
+             tuned_dim[0], tuned_dim[1], tile_x, tile_y, best_usec);
+    wisdom_store(key, config);
+    printf("# wisdom stored: %s %s\n", key, config);
+  }
+}
+
+/** apply the configuration stored in the wisdom file for this run, if any */
+static void wisdom_apply() {
+  int config[5] = {0};
+  if (rank == 0) {
+    char key[256], line[256];
+    wisdom_key(key, sizeof(key));
+    if (wisdom_load(key, line, sizeof(line)) &&
+        sscanf(line, "threads=%d dims=%dx%d tile=%dx%d", &config[2],
+               &config[0], &config[1], &config[3], &config[4]) >= 3) {
+      printf("# wisdom loaded: %s %s\n", key, line);
+      // explicit settings win over the stored ones
+      if (config[2] > 0 && getenv("OMP_NUM_THREADS") != NULL) {
+        printf("# wisdom threads ignored, OMP_NUM_THREADS is set\n");
+        config[2] = 0;
+      }
+      if (config[3] > 0 && tile_set) {
+        printf("# wisdom tile ignored, -b is set\n");
+        config[3] = config[4] = 0;
+      }
+    } else {
+      memset(config, 0, sizeof(config));
+    }
+  }
+  MPI_Bcast(config, 5, MPI_INT, 0, MPI_COMM_WORLD);
+  if (config[0] * config[1] == size) {
+    tuned_dim[0] = config[0];
+    tuned_dim[1] = config[1];
+  }
+  if (config[2] > 0) {
+    tuned_threads = config[2];
+    omp_set_num_threads(tuned_threads);
+  }
+  if (config[3] > 0 && config[4] > 0) {
+    tile_x = config[3];
+    tile_y = config[4];
+  }
+}
+
+/** step the local fields until convergence, return the number of steps */
+static int solve() {
+  int s;
+  int global_convergence = 0;
+  if (inplace_mode || chebyshev_mode) {
+    // blocking reduction: in place, there is no second field to discard a
+    // speculative step into; a Chebyshev step overwrites the field of the
+    // step before, so a speculative one would destroy the input of the
+    // converged step, which is the result kept
+    if (chebyshev_mode) {
+      chebyshev_reset();
+    }
+    for (s = 0; s < stencil_max_steps; s++) {
+      int local_convergence = stencil_step_hybrid();
+      if (snapshot_every > 0 && s % snapshot_every == 0) {
+        snapshot_take(s);
+      }
+      double t = trace_now();
+      MPI_Allreduce(&local_convergence, &global_convergence, 1, MPI_INT,
+                    MPI_LAND, MPI_COMM_WORLD);
+      trace_record(TRACE_ALLREDUCE, t);
+      if (global_convergence) {
+        if (chebyshev_mode) {
+          // keep the input of step s, whose residual was tested; its halo
+          // is the one exchanged by step s - 1
+          stencil_t *tmp = local_prev_values;
+          local_prev_values = local_values;
+          local_values = tmp;
+        }
+        break;
+      }
+    }
+    return s;
+  }
+
+  // The convergence of step s is reduced while step s + 1 is computed
+  // speculatively; if step s converged, step s + 1 is discarded by swapping
+  // the buffers back, so steps and results match a blocking reduction.
+  int local_convergence = stencil_step_hybrid();
+  MPI_Request request;
+  MPI_Iallreduce(&local_convergence, &global_convergence, 1, MPI_INT, MPI_LAND,
+                 MPI_COMM_WORLD, &request);
+  for (s = 0; s < stencil_max_steps; s++) {
+    if (snapshot_every > 0 && s % snapshot_every == 0) {
+      snapshot_take(s);
+    }
+    int speculated = s + 1 < stencil_max_steps;
+    int next_convergence = 1;
+    if (speculated) {
+      next_convergence = stencil_step_hybrid();
+    }
+    double t = trace_now();
+    MPI_Wait(&request, MPI_STATUS_IGNORE);
+    trace_record(TRACE_ALLREDUCE, t);
     if (global_convergence) {
+      if (speculated) {
+        stencil_t *tmp = local_prev_values;
+        local_prev_values = local_values;
+        local_values = tmp;
+      }
+      break;
+    }
+    if (speculated) {
+      local_convergence = next_convergence;
+      MPI_Iallreduce(&local_convergence, &global_convergence, 1, MPI_INT,
+                     MPI_LAND, MPI_COMM_WORLD, &request);
+    }
+  }
+  return s;
+}
+
+/** start from the tile src, run steps explicit steps, or parareal_coarse
+ * ADI steps covering as much time, and store the result in dst */
+static void parareal_propagate(const stencil_t *src, stencil_t *dst,
+                               int steps, int coarse) {
+  memcpy(local_values, src, LOCAL_CELLS * sizeof(stencil_t));
+  memcpy(local_prev_values, src, LOCAL_CELLS * sizeof(stencil_t));
+  if (coarse) {
+    for (int c = 0; c < parareal_coarse; c++) {
+      stencil_step_adi();
+    }
+  } else {
+    for (int s = 0; s < steps; s++) {
+      stencil_step_explicit();
+    }
+  }
+  memcpy(dst, local_values, LOCAL_CELLS * sizeof(stencil_t));
+}
+
+/** Parareal integration of parareal_steps explicit steps: the world is split
+ * into parareal_slices groups, each with the same spatial decomposition and
+ * in charge of one time window. Every iteration runs the fine explicit
+ * solver on all windows in parallel, then corrects the window starts one
+ * after the other with the coarse ADI propagator:
+ *   U[k+1] = G(U[k]) + F(U_old[k]) - G(U_old[k])
+ * After i iterations the first i windows are exact, so at most
+ * parareal_slices iterations are run. */
+static void parareal() {
+  int world_rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  const int group_size = size / parareal_slices;
+  const int slice = world_rank / group_size;
+  const int window = parareal_steps / parareal_slices;
+  MPI_Comm comm_slice;
+  MPI_Comm_split(MPI_COMM_WORLD, slice, world_rank, &comm_slice);
+  adi_factor = (double)window / parareal_coarse;
+  tuned_dim[0] = tuned_dim[1] = 0;
+  setup_2D_topology(comm_slice);
+  allocate_local_stencil();
+  create_halo_type();
+
+  // the same place in the grid in the previous and next slices
+  const int prev_slice = slice > 0 ? world_rank - group_size : MPI_PROC_NULL;
+  const int next_slice =
+      slice < parareal_slices - 1 ? world_rank + group_size : MPI_PROC_NULL;
+  const size_t bytes = LOCAL_CELLS * sizeof(stencil_t);
+  stencil_t *start = malloc(bytes);  // window start U[k]
+  stencil_t *end = malloc(bytes);    // window end, next start
+  stencil_t *fine = malloc(bytes);   // F(U_old[k])
+  stencil_t *coarse = malloc(bytes); // G(U_old[k])
+  stencil_t *guess = malloc(bytes);  // G(U[k])
+
+  struct timespec t1, t2;
+  MPI_Barrier(MPI_COMM_WORLD);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  // initial guess: one coarse sweep through the windows
+  if (slice == 0) {
+    local_stencil_init(start);
+  } else {
+    MPI_Recv(start, LOCAL_CELLS, MPI_FLOAT, prev_slice, 0, MPI_COMM_WORLD,
+             MPI_STATUS_IGNORE);
+  }
+  parareal_propagate(start, coarse, window, 1);
+  memcpy(end, coarse, bytes);
+  MPI_Send(end, LOCAL_CELLS, MPI_FLOAT, next_slice, 0, MPI_COMM_WORLD);
+
+  int k;
+  double correction = 0.0;
+  for (k = 0; k < parareal_slices; k++) {
+    parareal_propagate(start, fine, window, 0);
+    if (slice > 0) {
+      MPI_Recv(start, LOCAL_CELLS, MPI_FLOAT, prev_slice, 0, MPI_COMM_WORLD,
+               MPI_STATUS_IGNORE);
+    }
+    parareal_propagate(start, guess, window, 1);
+    double local_correction = 0.0;
+    for (int i = 0; i < LOCAL_CELLS; i++) {
+      stencil_t next = guess[i] + fine[i] - coarse[i];
+      if (fabs(next - end[i]) > local_correction) {
+        local_correction = fabs(next - end[i]);
+      }
+      end[i] = next;
+      coarse[i] = guess[i];
+    }
+    MPI_Send(end, LOCAL_CELLS, MPI_FLOAT, next_slice, 0, MPI_COMM_WORLD);
+    MPI_Allreduce(&local_correction, &correction, 1, MPI_DOUBLE, MPI_MAX,
+                  MPI_COMM_WORLD);
+    if (rank == 0 && slice == 0) {
+      printf("# parareal iteration %d: max correction = %g\n", k, correction);
+    }
+    if (correction < parareal_tolerance) {
+      k++;
       break;
     }
   }
+  MPI_Barrier(MPI_COMM_WORLD);
+  clock_gettime(CLOCK_MONOTONIC, &t2);
+
+  // the result is the end of the last window
+  const int last = slice == parareal_slices - 1;
+  double local_stats[3] = {INFINITY, -INFINITY, 0.0};
+  for (int y = STENCIL_RADIUS; last && y < local_size_y + STENCIL_RADIUS;
+       y++) {
+    for (int x = STENCIL_RADIUS; x < local_size_x + STENCIL_RADIUS; x++) {
+      double v = end[IND(x, y)];
+      local_stats[0] = v < local_stats[0] ? v : local_stats[0];
+      local_stats[1] = v > local_stats[1] ? v : local_stats[1];
+      local_stats[2] += v;
+    }
+  }
+  double stats[3];
+  MPI_Reduce(&local_stats[0], &stats[0], 1, MPI_DOUBLE, MPI_MIN, 0,
+             MPI_COMM_WORLD);
+  MPI_Reduce(&local_stats[1], &stats[1], 1, MPI_DOUBLE, MPI_MAX, 0,
+             MPI_COMM_WORLD);
+  MPI_Reduce(&local_stats[2], &stats[2], 1, MPI_DOUBLE, MPI_SUM, 0,
+             MPI_COMM_WORLD);
+  const long cells =
+      (long)(size_x - 2 * STENCIL_RADIUS) * (size_y - 2 * STENCIL_RADIUS);
+  if (world_rank == 0) {
+    const double t_usec = elapsed_usec(&t1, &t2);
+    printf("# parareal slices = %d\n", parareal_slices);
+    printf("# parareal iterations = %d\n", k);
+    printf("# steps = %d\n", window * parareal_slices);
+    printf("# time = %g usecs.\n", t_usec);
+    printf("# gflops = %g\n", (STENCIL_FLOPS * (double)size_x * size_y *
+                               window * parareal_slices) /
+                                  (t_usec * 1000));
+    printf("# min = %g\n", stats[0]);
+    printf("# max = %g\n", stats[1]);
+    printf("# mean = %g\n", stats[2] / cells);
+  }
+
+  // the last slice checks the result against the fine solver run serially
+  // in time over all the windows
+  if (test_mode) {
+    double local_max[2] = {0.0, 0.0}; // mismatches, max error
+    if (last) {
+      local_stencil_init(start);
+      parareal_propagate(start, guess, window * parareal_slices, 0);
+      for (int y = STENCIL_RADIUS; y < local_size_y + STENCIL_RADIUS; y++) {
+        for (int x = STENCIL_RADIUS; x < local_size_x + STENCIL_RADIUS;
+             x++) {
+          double error = fabs(end[IND(x, y)] - guess[IND(x, y)]);
+          local_max[0] += error > epsilon;
+          local_max[1] = error > local_max[1] ? error : local_max[1];
+        }
+      }
+    }
+    double mismatches, max_error;
+    MPI_Reduce(&local_max[0], &mismatches, 1, MPI_DOUBLE, MPI_SUM, 0,
+               MPI_COMM_WORLD);
+    MPI_Reduce(&local_max[1], &max_error, 1, MPI_DOUBLE, MPI_MAX, 0,
+               MPI_COMM_WORLD);
+    if (world_rank == 0) {
+      printf("Test mode\n");
+      printf("# verify mismatches = %.0f / %ld cells\n", mismatches, cells);
+      printf("# verify max error = %g\n", max_error);
+      if (mismatches > 0.0) {
+        printf("Results do not match!\n");
+      } else {
+        printf("Results match perfectly.\n");
+      }
+    }
+  }
+
+  free(start);
+  free(end);
+  free(fine);
+  free(coarse);
+  free(guess);
+  release_2D_topology();
+  MPI_Comm_free(&comm_slice);
+}
+
+/** wait for the next job on the server socket, keeping the client
+ * connection open between jobs; return the grid size, 0 to shut down */
+static int server_next_job(int listener, int *client, FILE **in) {
+  char line[256];
+  for (;;) {
+    if (*in == NULL) {
+      *client = accept(listener, NULL, NULL);
+      if (*client < 0) {
+        return 0;
+      }
+      *in = fdopen(*client, "r");
+    }
+    if (fgets(line, sizeof(line), *in) == NULL) {
+      fclose(*in); // closes the client socket
+      *in = NULL;
+      continue;
+    }
+    int job_size;
+    if (strncmp(line, "quit", 4) == 0) {
+      dprintf(*client, "end\n");
+      return 0;
+    }
+    if (sscanf(line, "solve %d", &job_size) == 1 &&
+        job_size > 2 * STENCIL_RADIUS) {
+      return job_size;
+    }
+    dprintf(*client, "error: expected \"solve <size>\" or \"quit\"\nend\n");
+  }
+}
+
+/** serve solve requests on a Unix socket: each job starts from the initial
+ * condition and answers with its stats and a summary of the result. The
+ * communicators, datatypes and buffers are kept from one job to the next
+ * and only rebuilt when the grid size changes. */
+static void serve() {
+  int listener = -1, client = -1;
+  FILE *in = NULL;
+  int job_size = 0;
+  if (rank == 0) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", server_path);
+    unlink(server_path);
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener >= 0 &&
+        bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+        listen(listener, 8) == 0) {
+      printf("# server = %s\n", server_path);
+      fflush(stdout);
+      job_size = server_next_job(listener, &client, &in);
+    } else {
+      perror(server_path);
+    }
+  }
+  MPI_Bcast(&job_size, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+  // snapshot files would be overwritten by every job
+  snapshot_every = 0;
+  int configured = 0;
+  while (job_size > 0) {
+    struct timespec t0, t1, t2;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (!configured || job_size != size_x) {
+      if (configured) {
+        release_2D_topology();
+      }
+      size_x = job_size;
+      size_y = job_size;
+      tuned_dim[0] = tuned_dim[1] = 0;
+      wisdom_apply();
+      setup_2D_topology(MPI_COMM_WORLD);
+      allocate_local_stencil();
+      create_halo_type();
+      configured = 1;
+    }
+
+    // even tiles leave the rest of an interior that does not split over the
+    // grid unowned: refuse the job rather than answer it wrongly
+    if ((size_x - 2 * STENCIL_RADIUS) % grid_dim[0] != 0 ||
+        (size_y - 2 * STENCIL_RADIUS) % grid_dim[1] != 0) {
+      if (rank == 0) {
+        dprintf(client, "error: interior of size %d does not split over "
+                        "the %dx%d grid\nend\n",
+                size_x - 2 * STENCIL_RADIUS, grid_dim[0], grid_dim[1]);
+        job_size = server_next_job(listener, &client, &in);
+      }
+      MPI_Bcast(&job_size, 1, MPI_INT, 0, MPI_COMM_WORLD);
+      continue;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    local_stencil_init(local_values);
+    if (local_prev_values != NULL) {
+      memcpy(local_prev_values, local_values,
+             LOCAL_CELLS * sizeof(stencil_t));
+    }
+    int s = solve();
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+
+    // min, max and sum of the interior
+    double local_stats[3] = {INFINITY, -INFINITY, 0.0};
+    for (int y = STENCIL_RADIUS; y < local_size_y + STENCIL_RADIUS; y++) {
+      for (int x = STENCIL_RADIUS; x < local_size_x + STENCIL_RADIUS; x++) {
+        double v = local_values[IND(x, y)];
+        local_stats[0] = v < local_stats[0] ? v : local_stats[0];
+        local_stats[1] = v > local_stats[1] ? v : local_stats[1];
+        local_stats[2] += v;
+      }
+    }
+    double stats[3];
+    MPI_Reduce(&local_stats[0], &stats[0], 1, MPI_DOUBLE, MPI_MIN, 0,
+               MPI_COMM_WORLD);
+    MPI_Reduce(&local_stats[1], &stats[1], 1, MPI_DOUBLE, MPI_MAX, 0,
+               MPI_COMM_WORLD);
+    MPI_Reduce(&local_stats[2], &stats[2], 1, MPI_DOUBLE, MPI_SUM, 0,
+               MPI_COMM_WORLD);
+
+    if (rank == 0) {
+      const double t_usec = elapsed_usec(&t1, &t2);
+      const long cells = (long)(size_x - 2 * STENCIL_RADIUS) *
+                         (size_y - 2 * STENCIL_RADIUS);
+      dprintf(client, "# size = %d\n", size_x);
+      dprintf(client, "# stencil = %s\n", STENCIL_NAME);
+      dprintf(client, "# setup = %g usecs.\n", elapsed_usec(&t0, &t1));
+      dprintf(client, "# steps = %d\n", s);
+      dprintf(client, "# time = %g usecs.\n", t_usec);
+      dprintf(client, "# gflops = %g\n",
+              (STENCIL_FLOPS * (double)size_x * size_y * s) /
+                  (t_usec * 1000));
+      dprintf(client, "# min = %g\n", stats[0]);
+      dprintf(client, "# max = %g\n", stats[1]);
+      dprintf(client, "# mean = %g\n", stats[2] / cells);
+      dprintf(client, "end\n");
+      job_size = server_next_job(listener, &client, &in);
+    }
+    MPI_Bcast(&job_size, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  }
+
+  if (configured) {
+    release_2D_topology();
+  }
+  if (rank == 0) {
+    if (in != NULL) {
+      fclose(in);
+    }
+    if (listener >= 0) {
+      close(listener);
+      unlink(server_path);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+
+  MPI_Init(&argc, &argv);
+  setup_process();
+
+  if (setup_option(argc, argv) != 0) {
+    return EXIT_FAILURE;
+  }
+
+  if (server_path[0] != '\0') {
+    trace_start();
+    serve();
+    trace_finish();
+    stencil_free();
+    MPI_Finalize();
+    return 0;
+  }
+  if (parareal_slices > 0) {
+    trace_start();
+    parareal();
+    trace_finish();
+    stencil_free();
+    MPI_Finalize();
+    return 0;
+  }
+
+  if (autotune_mode) {
+    autotune();
+  } else {
+    wisdom_apply();
+  }
+  setup_2D_topology(MPI_COMM_WORLD);
+  allocate_local_stencil();
+  create_halo_type();
+  report_placement();
+  mask_report();
+  trace_start();
+  snapshot_start();
+
+  struct timespec t1, t2;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  distribute_stencils();
+  warm_start();
+  int s = solve();
   global_stencil();
   clock_gettime(CLOCK_MONOTONIC, &t2);
 
@@ -407,12 +3271,22 @@ int main(int argc, char **argv) {
                           (t2.tv_nsec - t1.tv_nsec) / 1000.0;
     printf("# steps = %d\n", s);
     printf("# time = %g usecs.\n", t_usec);
-    printf("# gflops = %g\n", (6.0 * size_x * size_y * s) / (t_usec * 1000));
+    printf("# gflops = %g\n",
+           (STENCIL_FLOPS * (double)size_x * size_y * s) / (t_usec * 1000));
+    if (chebyshev_mode) {
+      printf("# chebyshev bounds = [%g, %g]\n", chebyshev_bounds[0],
+             chebyshev_bounds[1]);
+    }
   }
+  halo_codec_report();
+  snapshot_finish();
+  warm_save();
+  trace_finish();
 
   if (test_mode) {
-    test();
+    test(s);
   }
 
+  stencil_free();
   clean_process();
 }
@@ -0,0 +1,79 @@
+#ifndef STENCIL_INPLACE_H
+#define STENCIL_INPLACE_H
+
+/* Rolling-window kernel of the in-place steps, shared by all the versions and
+ * by the solver core library. */
+
+#include <math.h>
+#include <string.h>
+
+#include "stencil.h"
+
+#define INPLACE_ROWS (2 * STENCIL_RADIUS + 1) // old rows read by a row update
+
+/** compute the tile [x0, x1) x [y0, y1) of values, a field of row stride
+ * size_x, in place, return 1 if all of its cells have converged. Row r of
+ * the tile and of its halo is copied to the window slots r % INPLACE_ROWS
+ * and r % INPLACE_ROWS + INPLACE_ROWS, so the old rows read by any row
+ * update are contiguous in the window: outside the tile from above and
+ * below, STENCIL_RADIUS saved rows of stride size_x starting at column
+ * x0 - STENCIL_RADIUS, inside from the field, its old cells left and right
+ * of the tile from sides, 2 * STENCIL_RADIUS per row of the field, or from
+ * the field too if sides is NULL. The window holds 2 * INPLACE_ROWS rows of
+ * x1 - x0 + 2 * STENCIL_RADIUS cells. Cells are updated with the conduction
+ * coeff coeff and have converged if they move by at most threshold. With
+ * runs, only the active cells of a masked domain are updated: the runs of
+ * row y are row_runs[y - STENCIL_RADIUS] to row_runs[y - STENCIL_RADIUS + 1],
+ * run i covers the columns runs[2 * i] to runs[2 * i + 1], clipped to the
+ * tile; runs NULL updates the whole tile. */
+static int inplace_tile(stencil_t *values, int size_x, int x0, int x1, int y0,
+                        int y1, const stencil_t *above, const stencil_t *below,
+                        const stencil_t *sides, stencil_t *window,
+                        const int *row_runs, const int *runs, stencil_t coeff,
+                        stencil_t threshold) {
+  int convergence = 1;
+  const int w = x1 - x0 + 2 * STENCIL_RADIUS; // window row stride
+  const size_t row_size = w * sizeof(stencil_t);
+
+  for (int r = y0 - STENCIL_RADIUS; r < y1 + STENCIL_RADIUS; r++) {
+    stencil_t *slot = &window[((r - y0 + STENCIL_RADIUS) % INPLACE_ROWS) * w];
+    if (r < y0) {
+      memcpy(slot, &above[(r - y0 + STENCIL_RADIUS) * size_x], row_size);
+    } else if (r >= y1) {
+      memcpy(slot, &below[(r - y1) * size_x], row_size);
+    } else if (sides == NULL) {
+      memcpy(slot, &values[x0 - STENCIL_RADIUS + size_x * r], row_size);
+    } else {
+      const stencil_t *side = &sides[r * 2 * STENCIL_RADIUS];
+      memcpy(slot, side, STENCIL_RADIUS * sizeof(stencil_t));
+      memcpy(&slot[STENCIL_RADIUS], &values[x0 + size_x * r],
+             (x1 - x0) * sizeof(stencil_t));
+      memcpy(&slot[w - STENCIL_RADIUS], &side[STENCIL_RADIUS],
+             STENCIL_RADIUS * sizeof(stencil_t));
+    }
+    memcpy(slot + INPLACE_ROWS * w, slot, row_size);
+    int y = r - STENCIL_RADIUS; // last row whose old neighbours are loaded
+    if (y < y0) {
+      continue;
+    }
+    const stencil_t *old =
+        &window[((y - y0) % INPLACE_ROWS + STENCIL_RADIUS) * w +
+                STENCIL_RADIUS];
+    const int first = runs != NULL ? row_runs[y - STENCIL_RADIUS] : 0;
+    const int last = runs != NULL ? row_runs[y - STENCIL_RADIUS + 1] : 1;
+    for (int i = first; i < last; i++) {
+      int start = runs != NULL && runs[2 * i] > x0 ? runs[2 * i] : x0;
+      int end = runs != NULL && runs[2 * i + 1] < x1 ? runs[2 * i + 1] : x1;
+      for (int x = start; x < end; x++) {
+        stencil_t next = STENCIL_APPLY(&old[x - x0], w, coeff);
+        if (fabs(old[x - x0] - next) > threshold) {
+          convergence = 0;
+        }
+        values[x + size_x * y] = next;
+      }
+    }
+  }
+  return convergence;
+}
+
+#endif
@@ -0,0 +1,184 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <omp.h>
+
+#include "stencil.h"
+#include "stencil_inplace.h"
+#include "stencil_lib.h"
+
+/** conduction coeff used in computation */
+static const stencil_t alpha = 0.02;
+
+/** threshold for convergence */
+static const stencil_t epsilon = 0.0001;
+
+/** max number of steps */
+static const int stencil_max_steps = 100000;
+
+/** the field is split in bands of rows updated in place by the threads; the
+ * old rows each band reads from its neighbours are saved before a step and
+ * each thread rolls a window of old rows through its band */
+struct stencil_solver {
+  int size_x, size_y;
+  stencil_t *values;    // the field, updated in place
+  int band_y;           // rows per band
+  int band_count;       // bands of the interior
+  stencil_t *strips;    // old rows above and below each band
+  stencil_t *windows;   // rolling windows of old rows, one per thread
+  int window_cells;     // window size of one thread
+  int threads;          // windows allocated
+  int steps;            // steps computed
+  int converged;        // set by the last step
+  double time_usec;     // time spent in the steps
+};
+
+/** init values to 0, borders of STENCIL_RADIUS cells to non-zero */
+static void solver_init(stencil_solver_t *solver) {
+  const int size_x = solver->size_x;
+  const int size_y = solver->size_y;
+  stencil_t *values = solver->values;
+  int x, y;
+  memset(values, 0, size_x * size_y * sizeof(stencil_t));
+  for (y = 0; y < STENCIL_RADIUS; y++) {
+    for (x = 0; x < size_x; x++) {
+      values[x + size_x * y] = x;
+      values[x + size_x * (size_y - 1 - y)] = size_x - 1 - x;
+    }
+  }
+  for (y = 0; y < size_y; y++) {
+    for (x = 0; x < STENCIL_RADIUS; x++) {
+      values[x + size_x * y] = y;
+      values[size_x - 1 - x + size_x * y] = size_y - 1 - y;
+    }
+  }
+}
+
+/** compute one band in place, return 1 if all of its cells have converged.
+ * The band spans the interior width, so the fixed borders give the old
+ * cells left and right of it. */
+static int solver_band(stencil_solver_t *solver, int band, stencil_t *window) {
+  const int y0 = STENCIL_RADIUS + band * solver->band_y;
+  const int y1 = y0 + solver->band_y < solver->size_y - STENCIL_RADIUS
+                     ? y0 + solver->band_y
+                     : solver->size_y - STENCIL_RADIUS;
+  const stencil_t *above =
+      &solver->strips[band * 2 * STENCIL_RADIUS * solver->size_x];
+  return inplace_tile(solver->values, solver->size_x, STENCIL_RADIUS,
+                      solver->size_x - STENCIL_RADIUS, y0, y1, above,
+                      above + STENCIL_RADIUS * solver->size_x, NULL, window,
+                      NULL, NULL, alpha, epsilon);
+}
+
+/** compute one step in place, return 1 if the field has converged */
+static int solver_step(stencil_solver_t *solver) {
+  int convergence = 1;
+  const int size_x = solver->size_x;
+  const size_t strip_size = STENCIL_RADIUS * size_x * sizeof(stencil_t);
+#pragma omp parallel num_threads(solver->threads) reduction(& : convergence)
+  {
+#pragma omp for
+    for (int band = 0; band < solver->band_count; band++) {
+      int y0 = STENCIL_RADIUS + band * solver->band_y;
+      int y1 = y0 + solver->band_y < solver->size_y - STENCIL_RADIUS
+                   ? y0 + solver->band_y
+                   : solver->size_y - STENCIL_RADIUS;
+      stencil_t *strip = &solver->strips[band * 2 * STENCIL_RADIUS * size_x];
+      memcpy(strip, &solver->values[size_x * (y0 - STENCIL_RADIUS)],
+             strip_size);
+      memcpy(strip + STENCIL_RADIUS * size_x, &solver->values[size_x * y1],
+             strip_size);
+    }
+    stencil_t *window =
+        &solver->windows[omp_get_thread_num() * solver->window_cells];
+#pragma omp for schedule(static)
+    for (int band = 0; band < solver->band_count; band++) {
+      convergence &= solver_band(solver, band, window);
+    }
+  }
+  return convergence;
+}
+
+stencil_solver_t *stencil_solver_create(int size) {
+  if (size <= 2 * STENCIL_RADIUS) {
+    return NULL;
+  }
+  stencil_solver_t *solver = calloc(1, sizeof(stencil_solver_t));
+  if (solver == NULL) {
+    return NULL;
+  }
+  const int interior = size - 2 * STENCIL_RADIUS;
+  solver->size_x = size;
+  solver->size_y = size;
+  solver->threads = omp_get_max_threads();
+  solver->band_count =
+      solver->threads < interior ? solver->threads : interior;
+  solver->band_y = (interior + solver->band_count - 1) / solver->band_count;
+  solver->band_count = (interior + solver->band_y - 1) / solver->band_y;
+  solver->window_cells = 2 * INPLACE_ROWS * size;
+  solver->values = malloc((size_t)size * size * sizeof(stencil_t));
+  solver->strips = malloc((size_t)solver->band_count * 2 * STENCIL_RADIUS *
+                          size * sizeof(stencil_t));
+  solver->windows = malloc((size_t)solver->threads * solver->window_cells *
+                           sizeof(stencil_t));
+  if (solver->values == NULL || solver->strips == NULL ||
+      solver->windows == NULL) {
+    stencil_solver_destroy(solver);
+    return NULL;
+  }
+  solver_init(solver);
+  return solver;
+}
+
+void stencil_solver_destroy(stencil_solver_t *solver) {
+  if (solver == NULL) {
+    return;
+  }
+  free(solver->values);
+  free(solver->strips);
+  free(solver->windows);
+  free(solver);
+}
+
+int stencil_solver_step(stencil_solver_t *solver, int steps) {
+  struct timespec t1, t2;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  int s;
+  for (s = 0; s < steps && !solver->converged; s++) {
+    solver->converged = solver_step(solver);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t2);
+  solver->steps += s;
+  solver->time_usec += (t2.tv_sec - t1.tv_sec) * 1000000.0 +
+                       (t2.tv_nsec - t1.tv_nsec) / 1000.0;
+  return s;
+}
+
+int stencil_solver_solve(stencil_solver_t *solver) {
+  if (solver->steps < stencil_max_steps) {
+    stencil_solver_step(solver, stencil_max_steps - solver->steps);
+  }
+  return solver->steps;
+}
+
+float *stencil_solver_field(stencil_solver_t *solver) {
+  return solver->values;
+}
+
+void stencil_solver_stats(const stencil_solver_t *solver,
+                          stencil_stats_t *stats) {
+  stats->size_x = solver->size_x;
+  stats->size_y = solver->size_y;
+  stats->steps = solver->steps;
+  stats->converged = solver->converged;
+  stats->time_usec = solver->time_usec;
+  stats->gflops = solver->time_usec > 0.0
+                      ? (STENCIL_FLOPS * (double)solver->size_x *
+                         solver->size_y * solver->steps) /
+                            (solver->time_usec * 1000)
+                      : 0.0;
+}
+
+const char *stencil_solver_stencil(void) { return STENCIL_NAME; }
@@ -0,0 +1,54 @@
+#ifndef STENCIL_LIB_H
+#define STENCIL_LIB_H
+
+/* C interface of the solver core, built as bin/libstencil.so for the Python
+ * bindings (perf/stencil.py).
+ *
+ * The field is updated in place, so the pointer returned by
+ * stencil_solver_field() stays valid, and its contents current, until the
+ * solver is destroyed: callers may wrap it once and watch it change as they
+ * step. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct stencil_solver stencil_solver_t;
+
+/** counters of a solver, times in usecs */
+typedef struct {
+  int size_x, size_y; // field size, fixed borders included
+  int steps;          // steps computed since creation
+  int converged;      // 1 once a step changed no cell by more than epsilon
+  double time_usec;   // time spent computing the steps
+  double gflops;      // over all the steps computed
+} stencil_stats_t;
+
+/** new solver on a size x size field with the initial condition of the
+ * binaries, NULL if size is too small or memory is short */
+stencil_solver_t *stencil_solver_create(int size);
+
+void stencil_solver_destroy(stencil_solver_t *solver);
+
+/** run at most steps steps, fewer if the field converges, return the number
+ * of steps run */
+int stencil_solver_step(stencil_solver_t *solver, int steps);
+
+/** run until convergence or the binaries' step limit, return the total
+ * number of steps computed */
+int stencil_solver_solve(stencil_solver_t *solver);
+
+/** the field, size_y rows of size_x floats */
+float *stencil_solver_field(stencil_solver_t *solver);
+
+void stencil_solver_stats(const stencil_solver_t *solver,
+                          stencil_stats_t *stats);
+
+/** name of the stencil the library was built with */
+const char *stencil_solver_stencil(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
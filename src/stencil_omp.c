@@ -1,15 +1,19 @@
+#include <fcntl.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
 #include <omp.h>
+#include <pthread.h>
 #include <unistd.h>
 
-// #define STENCIL_SIZE 2
+#include "stencil.h"
+#include "stencil_inplace.h"
 
-typedef float stencil_t;
+// #define STENCIL_SIZE 2
 
 /** conduction coeff used in computation */
 static const stencil_t alpha = 0.02;
@@ -20,88 +24,605 @@ static const stencil_t epsilon = 0.0001;
 /** max number of steps */
 static const int stencil_max_steps = 100000;
 
+/** number of steps timed for each autotuning candidate */
+static const int autotune_steps = 100;
+
+/** tile shapes tried by the autotuner, clamped to the grid */
+static const int autotune_tiles[][2] = {
+    {1 << 30, 8}, {512, 16}, {256, 16}, {128, 32}, {64, 64}};
+static const int autotune_tile_count =
+    sizeof(autotune_tiles) / sizeof(autotune_tiles[0]);
+
 static stencil_t *values = NULL;
 static stencil_t *prev_values = NULL;
 
 static int size_x; // = STENCIL_SIZE;
 static int size_y; // = STENCIL_SIZE;
 
-/** init stencil values to 0, borders to non-zero */
+/** ADI time step in explicit steps, 0 = explicit stepping */
+static double adi_factor = 0.0;
+#define ADI_LINE_BLOCK 64              // lines solved together by a thread
+static stencil_t *adi_work = NULL;     // right-hand sides, one per line
+static stencil_t *adi_cp_x, *adi_inv_x; // Thomas coefficients along x
+static stencil_t *adi_cp_y, *adi_inv_y; // Thomas coefficients along y
+
+/** in-place steps: a single field, the old cells the tiles need from their
+ * neighbours are saved in strips and each thread rolls a window of old rows
+ * through its tile */
+static int inplace_mode = 0;
+static stencil_t *inplace_rows = NULL;    // old rows around each tile band
+static stencil_t *inplace_cols = NULL;    // old columns around each tile column
+static stencil_t *inplace_windows = NULL; // rolling windows of old rows
+static int inplace_window_cells = 0;      // window size of one thread
+static size_t inplace_reserved[3] = {0, 0, 0}; // allocated strips, windows
+
+/** Chebyshev acceleration (-k): x' = x + w[0] (x - x_prev) + w[1] (J(x) - x),
+ * J being the Jacobi update, with weights from bounds of its spectrum */
+static int chebyshev_mode = 0;
+#define CHEBYSHEV_SAMPLES 32       // modes sampled along each axis
+static double chebyshev_bounds[2]; // min and max eigenvalues of J
+static double chebyshev_rho;       // of the previous step, 0 before the first
+static stencil_t chebyshev_w[2];   // weights of the current step
+
+/** masked domain (-m): the active cells as runs of contiguous columns, the
+ * runs of row y being row_runs[y - STENCIL_RADIUS] to
+ * row_runs[y - STENCIL_RADIUS + 1] and run i covering the columns
+ * runs[2 * i] to runs[2 * i + 1]. Without a mask, every row is one run. */
+static const char *mask_path = NULL; // PGM geometry mask, NULL = rectangle
+static int *row_runs = NULL;
+static int *runs = NULL;
+static long active_cells = 0;
+
+/** per-thread deque of the tile scheduler: the owner pops tiles from head,
+ * thieves steal from tail, both under the lock */
+typedef struct {
+  int head, tail;
+  omp_lock_t lock;
+} __attribute__((aligned(64))) tile_deque_t;
+
+static int tile_x = 256; // tile width in cells
+static int tile_y = 16;  // tile height in rows
+static int tile_set = 0; // 1 if -b gave the tile, which wisdom then keeps
+static int tile_count_x, tile_count_y;
+static tile_deque_t *tile_deques = NULL;
+static int tile_deque_count = 0;
+
+/** size the tile grid and the deques for the current thread count */
+static void tile_setup(int nx, int ny) {
+  if (tile_x < 1 || tile_x > nx) {
+    tile_x = nx;
+  }
+  if (tile_y < 1 || tile_y > ny) {
+    tile_y = ny;
+  }
+  tile_count_x = (nx + tile_x - 1) / tile_x;
+  tile_count_y = (ny + tile_y - 1) / tile_y;
+  int threads = omp_get_max_threads();
+  if (threads > tile_deque_count) {
+    for (int t = 0; t < tile_deque_count; t++) {
+      omp_destroy_lock(&tile_deques[t].lock);
+    }
+    free(tile_deques);
+    tile_deques = aligned_alloc(64, threads * sizeof(tile_deque_t));
+    for (int t = 0; t < threads; t++) {
+      omp_init_lock(&tile_deques[t].lock);
+    }
+    tile_deque_count = threads;
+  }
+}
+
+static void tile_release(void) {
+  for (int t = 0; t < tile_deque_count; t++) {
+    omp_destroy_lock(&tile_deques[t].lock);
+  }
+  free(tile_deques);
+  tile_deques = NULL;
+  tile_deque_count = 0;
+}
+
+/** fill the calling thread's deque with its contiguous share of the tiles,
+ * the same share every step so that tiles stay on the thread that touched
+ * them first */
+static void tile_deque_reset(void) {
+  int t = omp_get_thread_num();
+  int threads = omp_get_num_threads();
+  int count = tile_count_x * tile_count_y;
+  omp_set_lock(&tile_deques[t].lock);
+  tile_deques[t].head = (long)count * t / threads;
+  tile_deques[t].tail = (long)count * (t + 1) / threads;
+  omp_unset_lock(&tile_deques[t].lock);
+}
+
+/** next tile for the calling thread: its own first, then stolen from the
+ * other deques, -1 when every deque is empty */
+static int tile_next(void) {
+  int t = omp_get_thread_num();
+  int threads = omp_get_num_threads();
+  int tile = -1;
+  omp_set_lock(&tile_deques[t].lock);
+  if (tile_deques[t].head < tile_deques[t].tail) {
+    tile = tile_deques[t].head++;
+  }
+  omp_unset_lock(&tile_deques[t].lock);
+  for (int i = 1; tile < 0 && i < threads; i++) {
+    tile_deque_t *victim = &tile_deques[(t + i) % threads];
+    omp_set_lock(&victim->lock);
+    if (victim->head < victim->tail) {
+      tile = --victim->tail;
+    }
+    omp_unset_lock(&victim->lock);
+  }
+  return tile;
+}
+
+/** zero the interior tile by tile with the scheduler's initial thread
+ * assignment, so that pages are first touched by the thread using them */
+static void tile_first_touch(stencil_t *buf) {
+#pragma omp parallel
+  {
+    int threads = omp_get_num_threads();
+    int count = tile_count_x * tile_count_y;
+    int t = omp_get_thread_num();
+    for (int tile = (long)count * t / threads;
+         tile < (long)count * (t + 1) / threads; tile++) {
+      int x0 = STENCIL_RADIUS + (tile % tile_count_x) * tile_x;
+      int y0 = STENCIL_RADIUS + (tile / tile_count_x) * tile_y;
+      int x1 = x0 + tile_x < size_x - STENCIL_RADIUS ? x0 + tile_x
+                                                     : size_x - STENCIL_RADIUS;
+      int y1 = y0 + tile_y < size_y - STENCIL_RADIUS ? y0 + tile_y
+                                                     : size_y - STENCIL_RADIUS;
+      for (int y = y0; y < y1; y++) {
+        memset(&buf[x0 + size_x * y], 0, (x1 - x0) * sizeof(stencil_t));
+      }
+    }
+  }
+}
+
+/** init stencil values to 0, borders of STENCIL_RADIUS cells to non-zero */
 static void stencil_init(void) {
   values = malloc(size_x * size_y * sizeof(stencil_t));
-  prev_values = malloc(size_x * size_y * sizeof(stencil_t));
+  tile_setup(size_x - 2 * STENCIL_RADIUS, size_y - 2 * STENCIL_RADIUS);
+  tile_first_touch(values);
+  if (!inplace_mode) {
+    prev_values = malloc(size_x * size_y * sizeof(stencil_t));
+    tile_first_touch(prev_values);
+  }
   int x, y;
-  for (x = 0; x < size_x; x++) {
-    for (y = 0; y < size_y; y++) {
-      values[x + size_x * y] = 0.0;
+  for (y = 0; y < STENCIL_RADIUS; y++) {
+    for (x = 0; x < size_x; x++) {
+      values[x + size_x * y] = x;
+      values[x + size_x * (size_y - 1 - y)] = size_x - 1 - x;
     }
   }
-  for (x = 0; x < size_x; x++) {
-    values[x + size_x * 0] = x;
-    values[x + size_x * (size_y - 1)] = size_x - 1 - x;
-  }
   for (y = 0; y < size_y; y++) {
-    values[0 + size_x * y] = y;
-    values[size_x - 1 + size_x * y] = size_y - 1 - y;
+    for (x = 0; x < STENCIL_RADIUS; x++) {
+      values[x + size_x * y] = y;
+      values[size_x - 1 - x + size_x * y] = size_y - 1 - y;
+    }
+  }
+  if (prev_values != NULL) {
+    memcpy(prev_values, values, size_x * size_y * sizeof(stencil_t));
   }
-  memcpy(prev_values, values, size_x * size_y * sizeof(stencil_t));
 }
 
-static void stencil_free(void) {
-  free(values);
-  free(prev_values);
+/** runs of the active cells of the interior in mask; return the run count,
+ * only counted if out is NULL */
+static int mask_runs(const uint8_t *mask, int *starts, int *out) {
+  const int nx = size_x - 2 * STENCIL_RADIUS;
+  const int ny = size_y - 2 * STENCIL_RADIUS;
+  int count = 0;
+  for (int y = 0; y < ny; y++) {
+    const uint8_t *row = &mask[STENCIL_RADIUS + size_x * (y + STENCIL_RADIUS)];
+    starts[y] = count;
+    for (int x = 0; x < nx; x++) {
+      if (row[x] && (x == 0 || !row[x - 1])) {
+        if (out != NULL) {
+          out[2 * count] = x + STENCIL_RADIUS;
+        }
+      }
+      if (row[x] && (x == nx - 1 || !row[x + 1])) {
+        if (out != NULL) {
+          out[2 * count + 1] = x + 1 + STENCIL_RADIUS;
+        }
+        count++;
+      }
+    }
+  }
+  starts[ny] = count;
+  return count;
 }
 
-/** display a (part of) the stencil values */
-static void stencil_display(int x0, int x1, int y0, int y1) {
-  int x, y;
-  for (y = y0; y <= y1; y++) {
-    for (x = x0; x <= x1; x++) {
-      printf("%8.5g ", values[x + size_x * y]);
+/** build the runs of the interior: one per row without a mask, else from
+ * the binary PGM (P5) mask of the whole grid, borders included, whose
+ * nonzero pixels are the active cells; the others keep their initial value
+ * like the borders. Return -1 if the mask cannot be read. */
+static int setup_runs(void) {
+  const int ny = size_y - 2 * STENCIL_RADIUS;
+  row_runs = malloc((ny + 1) * sizeof(int));
+  if (mask_path == NULL) {
+    runs = malloc(2 * ny * sizeof(int));
+    for (int y = 0; y <= ny; y++) {
+      row_runs[y] = y;
+    }
+    for (int y = 0; y < ny; y++) {
+      runs[2 * y] = STENCIL_RADIUS;
+      runs[2 * y + 1] = size_x - STENCIL_RADIUS;
+    }
+    active_cells = (long)(size_x - 2 * STENCIL_RADIUS) * ny;
+    return 0;
+  }
+
+  FILE *in = fopen(mask_path, "rb");
+  int width, height, maxval;
+  if (in == NULL ||
+      fscanf(in, "P5 %d %d %d", &width, &height, &maxval) != 3 ||
+      width != size_x || height != size_y || maxval > 255 ||
+      fgetc(in) == EOF) {
+    fprintf(stderr, "%s: not a %dx%d 8-bit PGM mask\n", mask_path, size_x,
+            size_y);
+    if (in != NULL) {
+      fclose(in);
     }
-    printf("\n");
+    return -1;
+  }
+  uint8_t *mask = malloc((size_t)size_x * size_y);
+  size_t read = fread(mask, 1, (size_t)size_x * size_y, in);
+  fclose(in);
+  if (read != (size_t)size_x * size_y) {
+    fprintf(stderr, "%s: truncated mask\n", mask_path);
+    free(mask);
+    return -1;
   }
+  int count = mask_runs(mask, row_runs, NULL);
+  runs = malloc((2 * count + 1) * sizeof(int));
+  mask_runs(mask, row_runs, runs);
+  free(mask);
+  active_cells = 0;
+  for (int i = 0; i < count; i++) {
+    active_cells += runs[2 * i + 1] - runs[2 * i];
+  }
+  return 0;
+}
+
+static void stencil_free(void) {
+  free(values);
+  free(prev_values);
+  free(inplace_rows);
+  free(inplace_cols);
+  free(inplace_windows);
+  values = prev_values = NULL;
+  inplace_rows = inplace_cols = inplace_windows = NULL;
+  inplace_reserved[0] = inplace_reserved[1] = inplace_reserved[2] = 0;
 }
 
-/** compute the next stencil step, return 1 if computation has converged */
+/** reference step: plain row-parallel loops, return 1 if converged */
 static int stencil_step(void) {
   int convergence = 1;
   stencil_t *tmp = prev_values;
   prev_values = values;
   values = tmp;
-  int x, y;
-  for (y = 1; y < size_y - 1; y++) {
-    for (x = 1; x < size_x - 1; x++) {
-      values[x + size_x * y] =
-          alpha * (prev_values[x - 1 + size_x * y] +
-                   prev_values[x + 1 + size_x * y] +
-                   prev_values[x + size_x * (y - 1)] +
-                   prev_values[x + size_x * (y + 1)]) +
-          (1.0 - 4.0 * alpha) * prev_values[x + size_x * y];
-      if (convergence && (fabs(prev_values[x + size_x * y] -
-                               values[x + size_x * y]) > epsilon)) {
-        convergence = 0;
+#pragma omp parallel for reduction(& : convergence)
+  for (int y = STENCIL_RADIUS; y < size_y - STENCIL_RADIUS; y++) {
+    for (int i = row_runs[y - STENCIL_RADIUS];
+         i < row_runs[y - STENCIL_RADIUS + 1]; i++) {
+      for (int x = runs[2 * i]; x < runs[2 * i + 1]; x++) {
+        values[x + size_x * y] =
+            STENCIL_APPLY(&prev_values[x + size_x * y], size_x, alpha);
+        if (fabs(prev_values[x + size_x * y] - values[x + size_x * y]) >
+            epsilon) {
+          convergence = 0;
+        }
       }
     }
   }
   return convergence;
 }
 
-static int stencil_step_omp(void) {
+/** compute one tile, return 1 if all of its cells have converged */
+static int stencil_tile(int tile) {
+  int convergence = 1;
+  int x0 = STENCIL_RADIUS + (tile % tile_count_x) * tile_x;
+  int y0 = STENCIL_RADIUS + (tile / tile_count_x) * tile_y;
+  int x1 = x0 + tile_x < size_x - STENCIL_RADIUS ? x0 + tile_x
+                                                 : size_x - STENCIL_RADIUS;
+  int y1 = y0 + tile_y < size_y - STENCIL_RADIUS ? y0 + tile_y
+                                                 : size_y - STENCIL_RADIUS;
+  for (int y = y0; y < y1; y++) {
+    for (int i = row_runs[y - STENCIL_RADIUS];
+         i < row_runs[y - STENCIL_RADIUS + 1]; i++) {
+      // the run clipped to the tile
+      int start = runs[2 * i] > x0 ? runs[2 * i] : x0;
+      int end = runs[2 * i + 1] < x1 ? runs[2 * i + 1] : x1;
+      for (int x = start; x < end; x++) {
+        values[x + size_x * y] =
+            STENCIL_APPLY(&prev_values[x + size_x * y], size_x, alpha);
+        if (fabs(prev_values[x + size_x * y] - values[x + size_x * y]) >
+            epsilon) {
+          convergence = 0;
+        }
+      }
+    }
+  }
+  return convergence;
+}
+
+/** bound the spectrum of J on the interior by its symbol at Dirichlet modes
+ * sampled from the slowest to the fastest, and restart the recurrence */
+static void chebyshev_reset(void) {
+  const int n[2] = {size_x - 2 * STENCIL_RADIUS, size_y - 2 * STENCIL_RADIUS};
+  chebyshev_bounds[0] = INFINITY;
+  chebyshev_bounds[1] = -INFINITY;
+  for (int i = 0; i < CHEBYSHEV_SAMPLES; i++) {
+    for (int j = 0; j < CHEBYSHEV_SAMPLES; j++) {
+      int k[2] = {1 + i * (n[0] - 1) / (CHEBYSHEV_SAMPLES - 1),
+                  1 + j * (n[1] - 1) / (CHEBYSHEV_SAMPLES - 1)};
+      double t[2] = {M_PI * k[0] / (n[0] + 1), M_PI * k[1] / (n[1] + 1)};
+      double g = STENCIL_SYMBOL(t, alpha);
+      chebyshev_bounds[0] = g < chebyshev_bounds[0] ? g : chebyshev_bounds[0];
+      chebyshev_bounds[1] = g > chebyshev_bounds[1] ? g : chebyshev_bounds[1];
+    }
+  }
+  chebyshev_rho = 0.0;
+}
+
+/** weights of the next step of the Chebyshev recurrence for I - J, whose
+ * spectrum lies in theta +- delta */
+static void chebyshev_next(void) {
+  const double theta = 1.0 - (chebyshev_bounds[0] + chebyshev_bounds[1]) / 2;
+  double delta = (chebyshev_bounds[1] - chebyshev_bounds[0]) / 2;
+  if (delta < 1e-12) {
+    delta = 1e-12;
+  }
+  const double sigma = theta / delta;
+  if (chebyshev_rho == 0.0) {
+    chebyshev_rho = 1.0 / sigma;
+    chebyshev_w[0] = 0.0;
+    chebyshev_w[1] = 1.0 / theta;
+  } else {
+    double rho = 1.0 / (2.0 * sigma - chebyshev_rho);
+    chebyshev_w[0] = rho * chebyshev_rho;
+    chebyshev_w[1] = 2.0 * rho / delta;
+    chebyshev_rho = rho;
+  }
+}
+
+/** compute one tile of a Chebyshev step, return 1 if all of its cells have
+ * converged; values still holds the field of the step before prev_values */
+static int stencil_tile_chebyshev(int tile) {
+  int convergence = 1;
+  const stencil_t w0 = chebyshev_w[0], w1 = chebyshev_w[1];
+  int x0 = STENCIL_RADIUS + (tile % tile_count_x) * tile_x;
+  int y0 = STENCIL_RADIUS + (tile / tile_count_x) * tile_y;
+  int x1 = x0 + tile_x < size_x - STENCIL_RADIUS ? x0 + tile_x
+                                                 : size_x - STENCIL_RADIUS;
+  int y1 = y0 + tile_y < size_y - STENCIL_RADIUS ? y0 + tile_y
+                                                 : size_y - STENCIL_RADIUS;
+  for (int y = y0; y < y1; y++) {
+    for (int i = row_runs[y - STENCIL_RADIUS];
+         i < row_runs[y - STENCIL_RADIUS + 1]; i++) {
+      int start = runs[2 * i] > x0 ? runs[2 * i] : x0;
+      int end = runs[2 * i + 1] < x1 ? runs[2 * i + 1] : x1;
+      for (int x = start; x < end; x++) {
+        stencil_t cur = prev_values[x + size_x * y];
+        stencil_t change =
+            STENCIL_APPLY(&prev_values[x + size_x * y], size_x, alpha) - cur;
+        values[x + size_x * y] =
+            cur + w0 * (cur - values[x + size_x * y]) + w1 * change;
+        if (fabs(change) > epsilon) {
+          convergence = 0;
+        }
+      }
+    }
+  }
+  return convergence;
+}
+
+/** grow the strips and windows to the current tiles and thread count */
+static void inplace_reserve(void) {
+  size_t needed[3];
+  needed[0] = (size_t)tile_count_y * 2 * STENCIL_RADIUS * size_x;
+  needed[1] = (size_t)tile_count_x * size_y * 2 * STENCIL_RADIUS;
+  inplace_window_cells = 2 * INPLACE_ROWS * (tile_x + 2 * STENCIL_RADIUS);
+  needed[2] = (size_t)omp_get_max_threads() * inplace_window_cells;
+  stencil_t **buffers[3] = {&inplace_rows, &inplace_cols, &inplace_windows};
+  for (int i = 0; i < 3; i++) {
+    if (needed[i] > inplace_reserved[i]) {
+      free(*buffers[i]);
+      *buffers[i] = malloc(needed[i] * sizeof(stencil_t));
+      inplace_reserved[i] = needed[i];
+    }
+  }
+}
+
+/** save the old cells that the tiles read from their neighbours before any
+ * tile is updated in place: the rows above and below each band of tiles and
+ * the columns left and right of each column of tiles */
+static void inplace_save_strips(void) {
+  const size_t strip_size = STENCIL_RADIUS * size_x * sizeof(stencil_t);
+#pragma omp for
+  for (int band = 0; band < tile_count_y; band++) {
+    int y0 = STENCIL_RADIUS + band * tile_y;
+    int y1 = y0 + tile_y < size_y - STENCIL_RADIUS ? y0 + tile_y
+                                                   : size_y - STENCIL_RADIUS;
+    stencil_t *strip = &inplace_rows[band * 2 * STENCIL_RADIUS * size_x];
+    memcpy(strip, &values[size_x * (y0 - STENCIL_RADIUS)], strip_size);
+    memcpy(strip + STENCIL_RADIUS * size_x, &values[size_x * y1], strip_size);
+  }
+#pragma omp for
+  for (int y = STENCIL_RADIUS; y < size_y - STENCIL_RADIUS; y++) {
+    for (int column = 0; column < tile_count_x; column++) {
+      int x0 = STENCIL_RADIUS + column * tile_x;
+      int x1 = x0 + tile_x < size_x - STENCIL_RADIUS ? x0 + tile_x
+                                                     : size_x - STENCIL_RADIUS;
+      stencil_t *strip =
+          &inplace_cols[(column * size_y + y) * 2 * STENCIL_RADIUS];
+      for (int k = 0; k < STENCIL_RADIUS; k++) {
+        strip[k] = values[x0 - STENCIL_RADIUS + k + size_x * y];
+        strip[STENCIL_RADIUS + k] = values[x1 + k + size_x * y];
+      }
+    }
+  }
+}
+
+/** compute one tile in place, return 1 if all of its cells have converged,
+ * the old cells around it taken from the saved strips */
+static int stencil_tile_inplace(int tile) {
+  int band = tile / tile_count_x;
+  int column = tile % tile_count_x;
+  int x0 = STENCIL_RADIUS + column * tile_x;
+  int y0 = STENCIL_RADIUS + band * tile_y;
+  int x1 = x0 + tile_x < size_x - STENCIL_RADIUS ? x0 + tile_x
+                                                 : size_x - STENCIL_RADIUS;
+  int y1 = y0 + tile_y < size_y - STENCIL_RADIUS ? y0 + tile_y
+                                                 : size_y - STENCIL_RADIUS;
+  const stencil_t *above =
+      &inplace_rows[band * 2 * STENCIL_RADIUS * size_x + x0 - STENCIL_RADIUS];
+  return inplace_tile(
+      values, size_x, x0, x1, y0, y1, above, above + STENCIL_RADIUS * size_x,
+      &inplace_cols[column * size_y * 2 * STENCIL_RADIUS],
+      &inplace_windows[omp_get_thread_num() * inplace_window_cells], row_runs,
+      runs, alpha, epsilon);
+}
+
+/** explicit step updating the field in place, tile by tile, return 1 if
+ * converged */
+static int stencil_step_inplace(void) {
+  int convergence = 1;
+  tile_setup(size_x - 2 * STENCIL_RADIUS, size_y - 2 * STENCIL_RADIUS);
+  inplace_reserve();
+#pragma omp parallel reduction(& : convergence)
+  {
+    inplace_save_strips();
+    tile_deque_reset();
+#pragma omp barrier
+    int tile;
+    while ((tile = tile_next()) >= 0) {
+      convergence &= stencil_tile_inplace(tile);
+    }
+  }
+  return convergence;
+}
+
+/** Thomas coefficients of the constant tridiagonal system
+ * -h x[i-1] + (1 + 2h) x[i] - h x[i+1] = d[i], i < n */
+static void adi_coefficients(int n, stencil_t h, stencil_t *cp,
+                             stencil_t *inv) {
+  double c_prev = 0.0;
+  for (int i = 0; i < n; i++) {
+    double m = 1.0 + 2.0 * h + h * c_prev;
+    inv[i] = 1.0 / m;
+    c_prev = -h / m;
+    cp[i] = c_prev;
+  }
+}
+
+/** solve lines [l0, l1) of a batch of n x m right-hand sides stored line
+ * index fastest (d[i * m + l]) in place; the inner loops run across lines */
+static void thomas_batch(stencil_t *d, int n, int m, int l0, int l1,
+                         const stencil_t *cp, const stencil_t *inv,
+                         stencil_t h) {
+  for (int l = l0; l < l1; l++) {
+    d[l] *= inv[0];
+  }
+  for (int i = 1; i < n; i++) {
+    for (int l = l0; l < l1; l++) {
+      d[i * m + l] = (d[i * m + l] + h * d[(i - 1) * m + l]) * inv[i];
+    }
+  }
+  for (int i = n - 2; i >= 0; i--) {
+    for (int l = l0; l < l1; l++) {
+      d[i * m + l] -= cp[i] * d[(i + 1) * m + l];
+    }
+  }
+}
+
+/** allocate the ADI work array and coefficients for the current grid */
+static void adi_setup(void) {
+  const stencil_t h = 0.5 * alpha * adi_factor;
+  adi_work = malloc((size_x - 2) * (size_y - 2) * sizeof(stencil_t));
+  adi_cp_x = malloc((size_x - 2) * sizeof(stencil_t));
+  adi_inv_x = malloc((size_x - 2) * sizeof(stencil_t));
+  adi_cp_y = malloc((size_y - 2) * sizeof(stencil_t));
+  adi_inv_y = malloc((size_y - 2) * sizeof(stencil_t));
+  adi_coefficients(size_x - 2, h, adi_cp_x, adi_inv_x);
+  adi_coefficients(size_y - 2, h, adi_cp_y, adi_inv_y);
+}
+
+static void adi_free(void) {
+  free(adi_work);
+  free(adi_cp_x);
+  free(adi_inv_x);
+  free(adi_cp_y);
+  free(adi_inv_y);
+  adi_work = NULL;
+}
+
+/** Peaceman-Rachford ADI step of adi_factor explicit steps: implicit along x
+ * and explicit along y for half a step, then the other way round */
+static int stencil_step_adi(void) {
   int convergence = 1;
   stencil_t *tmp = prev_values;
   prev_values = values;
   values = tmp;
-#pragma omp parallel for collapse(2) reduction(& : convergence)
+  const int nx = size_x - 2;
+  const int ny = size_y - 2;
+  const stencil_t h = 0.5 * alpha * adi_factor;
+
+  // x sweep, the rows are stored x-major so that the solve runs across rows
+#pragma omp parallel for
+  for (int y = 1; y < size_y - 1; y++) {
+    for (int x = 1; x < size_x - 1; x++) {
+      stencil_t rhs = prev_values[x + size_x * y] +
+                      h * (prev_values[x + size_x * (y - 1)] -
+                           2.0 * prev_values[x + size_x * y] +
+                           prev_values[x + size_x * (y + 1)]);
+      if (x == 1) {
+        rhs += h * prev_values[0 + size_x * y];
+      }
+      if (x == size_x - 2) {
+        rhs += h * prev_values[size_x - 1 + size_x * y];
+      }
+      adi_work[(x - 1) * ny + (y - 1)] = rhs;
+    }
+  }
+#pragma omp parallel for
+  for (int l = 0; l < ny; l += ADI_LINE_BLOCK) {
+    int l1 = l + ADI_LINE_BLOCK < ny ? l + ADI_LINE_BLOCK : ny;
+    thomas_batch(adi_work, nx, ny, l, l1, adi_cp_x, adi_inv_x, h);
+  }
+#pragma omp parallel for
   for (int y = 1; y < size_y - 1; y++) {
     for (int x = 1; x < size_x - 1; x++) {
-      values[x + size_x * y] =
-          alpha * (prev_values[x - 1 + size_x * y] +
-                   prev_values[x + 1 + size_x * y] +
-                   prev_values[x + size_x * (y - 1)] +
-                   prev_values[x + size_x * (y + 1)]) +
-          (1.0 - 4.0 * alpha) * prev_values[x + size_x * y];
+      values[x + size_x * y] = adi_work[(x - 1) * ny + (y - 1)];
+    }
+  }
 
+  // y sweep on the intermediate field, the columns are already y-major
+#pragma omp parallel for
+  for (int y = 1; y < size_y - 1; y++) {
+    for (int x = 1; x < size_x - 1; x++) {
+      stencil_t rhs = values[x + size_x * y] +
+                      h * (values[x - 1 + size_x * y] -
+                           2.0 * values[x + size_x * y] +
+                           values[x + 1 + size_x * y]);
+      if (y == 1) {
+        rhs += h * prev_values[x + size_x * 0];
+      }
+      if (y == size_y - 2) {
+        rhs += h * prev_values[x + size_x * (size_y - 1)];
+      }
+      adi_work[(y - 1) * nx + (x - 1)] = rhs;
+    }
+  }
+#pragma omp parallel for
+  for (int l = 0; l < nx; l += ADI_LINE_BLOCK) {
+    int l1 = l + ADI_LINE_BLOCK < nx ? l + ADI_LINE_BLOCK : nx;
+    thomas_batch(adi_work, ny, nx, l, l1, adi_cp_y, adi_inv_y, h);
+  }
+#pragma omp parallel for reduction(& : convergence)
+  for (int y = 1; y < size_y - 1; y++) {
+    for (int x = 1; x < size_x - 1; x++) {
+      values[x + size_x * y] = adi_work[(y - 1) * nx + (x - 1)];
       if (fabs(prev_values[x + size_x * y] - values[x + size_x * y]) >
           epsilon) {
         convergence = 0;
@@ -111,59 +632,722 @@ static int stencil_step_omp(void) {
   return convergence;
 }
 
+static int stencil_step_omp(void) {
+  if (adi_factor > 0.0) {
+    return stencil_step_adi();
+  }
+  if (inplace_mode) {
+    return stencil_step_inplace();
+  }
+  int convergence = 1;
+  stencil_t *tmp = prev_values;
+  prev_values = values;
+  values = tmp;
+  if (chebyshev_mode) {
+    chebyshev_next();
+  }
+  tile_setup(size_x - 2 * STENCIL_RADIUS, size_y - 2 * STENCIL_RADIUS);
+#pragma omp parallel reduction(& : convergence)
+  {
+    tile_deque_reset();
+#pragma omp barrier
+    int tile;
+    while ((tile = tile_next()) >= 0) {
+      convergence &= chebyshev_mode ? stencil_tile_chebyshev(tile)
+                                    : stencil_tile(tile);
+    }
+  }
+  return convergence;
+}
+
+/** out-of-core mode (-O file): the field lives in a file and in a scratch
+ * file next to it, each pass streams bands of rows from one to the other and
+ * applies ooc_steps steps on the way. The rows go through the step levels in
+ * blocks: a block of rows [y, y + n) entering level k completes the rows
+ * [y - STENCIL_RADIUS, y + n - STENCIL_RADIUS) of level k + 1, which the
+ * threads compute in parallel. Every level keeps its last 2 *
+ * STENCIL_RADIUS rows in front of the next block, so memory holds a block
+ * and a few rows per level whatever the grid size. A reader and a writer
+ * thread move the bands while the threads compute. */
+static const char *ooc_path = NULL;
+static int ooc_steps = 16;            // steps per pass over the files
+#define OOC_BAND_BYTES (4 << 20)      // bytes read or written at once
+#define OOC_SLOTS 2                   // bands in flight per direction
+#define OOC_BLOCK_CELLS (1 << 14)     // cells of a block worth the threads
+static int ooc_fd[2] = {-1, -1};      // field, scratch
+static char *ooc_scratch_path = NULL;
+static int ooc_src = 0;               // file holding the current field
+static int ooc_band_rows, ooc_band_count;
+static int ooc_depth;                 // steps of the current pass
+static int ooc_block_rows;            // rows of a block
+static stencil_t *ooc_levels = NULL;  // last rows of each level
+static int *ooc_level_y = NULL;       // first row held by each level
+static int *ooc_level_rows = NULL;    // rows held by each level
+static int *ooc_converged = NULL;     // per level of the current pass
+static stencil_t *ooc_out_slot;
+static int ooc_passes = 0, ooc_repeats = 0;
+static double ooc_wait_usec = 0.0;    // compute stalled on the I/O threads
+
+/** bands handed between the compute thread and an I/O thread */
+typedef struct {
+  stencil_t *slots[OOC_SLOTS];
+  int rows[OOC_SLOTS]; // rows held by each slot
+  long filled;         // bands put in the queue
+  long drained;        // bands taken out of it
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} ooc_queue_t;
+static ooc_queue_t ooc_in, ooc_out;
+
+/** read or write rows [y0, y0 + rows) of a file */
+static void ooc_io(int fd, stencil_t *buf, int y0, int rows, int write) {
+  char *p = (char *)buf;
+  size_t left = (size_t)rows * size_x * sizeof(stencil_t);
+  off_t offset = (off_t)y0 * size_x * sizeof(stencil_t);
+  while (left > 0) {
+    ssize_t n =
+        write ? pwrite(fd, p, left, offset) : pread(fd, p, left, offset);
+    if (n <= 0) {
+      perror(ooc_path);
+      exit(EXIT_FAILURE);
+    }
+    p += n;
+    left -= n;
+    offset += n;
+  }
+}
+
+/** wait until band can be taken from the queue (full) or put into it
+ * (!full), return its slot */
+static stencil_t *ooc_queue_wait(ooc_queue_t *q, long band, int full) {
+  pthread_mutex_lock(&q->lock);
+  while (full ? q->filled <= band : band - q->drained >= OOC_SLOTS) {
+    pthread_cond_wait(&q->cond, &q->lock);
+  }
+  pthread_mutex_unlock(&q->lock);
+  return q->slots[band % OOC_SLOTS];
+}
+
+/** the compute thread's waits, timed as I/O stalls */
+static stencil_t *ooc_queue_stall(ooc_queue_t *q, long band, int full) {
+  struct timespec t1, t2;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  stencil_t *slot = ooc_queue_wait(q, band, full);
+  clock_gettime(CLOCK_MONOTONIC, &t2);
+  ooc_wait_usec +=
+      (t2.tv_sec - t1.tv_sec) * 1000000.0 + (t2.tv_nsec - t1.tv_nsec) / 1000.0;
+  return slot;
+}
+
+static void ooc_queue_post(ooc_queue_t *q, int full) {
+  pthread_mutex_lock(&q->lock);
+  if (full) {
+    q->filled++;
+  } else {
+    q->drained++;
+  }
+  pthread_cond_broadcast(&q->cond);
+  pthread_mutex_unlock(&q->lock);
+}
+
+static int ooc_band_size(int band) {
+  int y0 = band * ooc_band_rows;
+  return y0 + ooc_band_rows < size_y ? ooc_band_rows : size_y - y0;
+}
+
+/** prefetch the bands of the current field */
+static void *ooc_reader(void *arg) {
+  (void)arg;
+  for (int band = 0; band < ooc_band_count; band++) {
+    stencil_t *slot = ooc_queue_wait(&ooc_in, band, 0);
+    ooc_in.rows[band % OOC_SLOTS] = ooc_band_size(band);
+    ooc_io(ooc_fd[ooc_src], slot, band * ooc_band_rows, ooc_band_size(band),
+           0);
+    ooc_queue_post(&ooc_in, 1);
+  }
+  return NULL;
+}
+
+/** write the bands of the next field behind the compute */
+static void *ooc_writer(void *arg) {
+  (void)arg;
+  for (int band = 0; band < ooc_band_count; band++) {
+    stencil_t *slot = ooc_queue_wait(&ooc_out, band, 1);
+    ooc_io(ooc_fd[!ooc_src], slot, band * ooc_band_rows,
+           ooc_out.rows[band % OOC_SLOTS], 1);
+    ooc_queue_post(&ooc_out, 0);
+  }
+  return NULL;
+}
+
+/** row y of level k, while the level holds it */
+static stencil_t *ooc_level_row(int k, int y) {
+  return &ooc_levels[((size_t)k * (ooc_block_rows + 2 * STENCIL_RADIUS) +
+                      y - ooc_level_y[k]) *
+                     size_x];
+}
+
+/** make room in level k for the rows [y, y + n) after the last 2 *
+ * STENCIL_RADIUS rows it holds, return where row y goes */
+static stencil_t *ooc_level_append(int k, int y, int n) {
+  int keep = ooc_level_rows[k] < 2 * STENCIL_RADIUS ? ooc_level_rows[k]
+                                                    : 2 * STENCIL_RADIUS;
+  stencil_t *first = ooc_level_row(k, ooc_level_y[k]);
+  memmove(first, ooc_level_row(k, ooc_level_y[k] + ooc_level_rows[k] - keep),
+          (size_t)keep * size_x * sizeof(stencil_t));
+  ooc_level_y[k] = y - keep;
+  ooc_level_rows[k] = keep + n;
+  return ooc_level_row(k, y);
+}
+
+/** append a row of the last level to the output bands */
+static void ooc_emit(int y, const stencil_t *row) {
+  int band = y / ooc_band_rows;
+  int r = y % ooc_band_rows;
+  if (r == 0) {
+    ooc_out_slot = ooc_queue_stall(&ooc_out, band, 0);
+  }
+  memcpy(&ooc_out_slot[r * size_x], row, size_x * sizeof(stencil_t));
+  if (r == ooc_band_size(band) - 1) {
+    ooc_out.rows[band % OOC_SLOTS] = r + 1;
+    ooc_queue_post(&ooc_out, 1);
+  }
+}
+
+/** rows [y, y + n) of level k are the last it holds: compute the rows of
+ * the next levels they complete, those of a block in parallel, and hand the
+ * rows of the last level to the output bands */
+static void ooc_push(int k, int y, int n) {
+  const size_t row_size = size_x * sizeof(stencil_t);
+  for (; k < ooc_depth; k++) {
+    int y0 = y - STENCIL_RADIUS > 0 ? y - STENCIL_RADIUS : 0;
+    int y1 = y + n - STENCIL_RADIUS; // rows whose old neighbours are loaded
+    if (y1 <= y0) {
+      return;
+    }
+    ooc_level_append(k + 1, y0, y1 - y0);
+    int convergence = 1;
+#pragma omp parallel for reduction(& : convergence) \
+    if ((long)(y1 - y0) * size_x >= OOC_BLOCK_CELLS)
+    for (int r = y0; r < y1; r++) {
+      const stencil_t *old = ooc_level_row(k, r);
+      stencil_t *next = ooc_level_row(k + 1, r);
+      if (r < STENCIL_RADIUS) {
+        memcpy(next, old, row_size);
+        continue;
+      }
+      memcpy(next, old, STENCIL_RADIUS * sizeof(stencil_t));
+      memcpy(&next[size_x - STENCIL_RADIUS], &old[size_x - STENCIL_RADIUS],
+             STENCIL_RADIUS * sizeof(stencil_t));
+      for (int x = STENCIL_RADIUS; x < size_x - STENCIL_RADIUS; x++) {
+        next[x] = STENCIL_APPLY(&old[x], size_x, alpha);
+        if (fabs(old[x] - next[x]) > epsilon) {
+          convergence = 0;
+        }
+      }
+    }
+    ooc_converged[k + 1] &= convergence;
+    y = y0;
+    n = y1 - y0;
+  }
+  for (int r = y; r < y + n; r++) {
+    ooc_emit(r, ooc_level_row(ooc_depth, r));
+  }
+}
+
+/** apply depth steps from the current field to the scratch file, return the
+ * first level that converged, 0 if none did */
+static int ooc_pass(int depth) {
+  ooc_depth = depth;
+  for (int k = 0; k <= depth; k++) {
+    ooc_converged[k] = 1;
+    ooc_level_y[k] = ooc_level_rows[k] = 0;
+  }
+  ooc_in.filled = ooc_in.drained = 0;
+  ooc_out.filled = ooc_out.drained = 0;
+  pthread_t reader, writer;
+  pthread_create(&reader, NULL, ooc_reader, NULL);
+  pthread_create(&writer, NULL, ooc_writer, NULL);
+  for (int band = 0; band < ooc_band_count; band++) {
+    stencil_t *slot = ooc_queue_stall(&ooc_in, band, 1);
+    const int rows = ooc_in.rows[band % OOC_SLOTS];
+    for (int r = 0; r < rows; r += ooc_block_rows) {
+      int n = rows - r < ooc_block_rows ? rows - r : ooc_block_rows;
+      int y = band * ooc_band_rows + r;
+      memcpy(ooc_level_append(0, y, n), &slot[r * size_x],
+             (size_t)n * size_x * sizeof(stencil_t));
+      ooc_push(0, y, n);
+    }
+    ooc_queue_post(&ooc_in, 0);
+  }
+  // the last rows are fixed borders: once a level has all its rows, they
+  // complete the next one
+  for (int k = 1; k <= depth; k++) {
+    int y = size_y - STENCIL_RADIUS;
+    memcpy(ooc_level_append(k, y, STENCIL_RADIUS), ooc_level_row(k - 1, y),
+           STENCIL_RADIUS * size_x * sizeof(stencil_t));
+    ooc_push(k, y, STENCIL_RADIUS);
+  }
+  pthread_join(reader, NULL);
+  pthread_join(writer, NULL);
+  ooc_passes++;
+  for (int k = 1; k <= depth; k++) {
+    if (ooc_converged[k]) {
+      return k;
+    }
+  }
+  return 0;
+}
+
+/** create the files, write the initial field of stencil_init() */
+static void ooc_init(void) {
+  ooc_scratch_path = malloc(strlen(ooc_path) + 5);
+  sprintf(ooc_scratch_path, "%s.tmp", ooc_path);
+  ooc_fd[0] = open(ooc_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  ooc_fd[1] = open(ooc_scratch_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (ooc_fd[0] < 0 || ooc_fd[1] < 0) {
+    perror(ooc_path);
+    exit(EXIT_FAILURE);
+  }
+  ooc_src = 0;
+  ooc_band_rows = OOC_BAND_BYTES / (size_x * sizeof(stencil_t));
+  if (ooc_band_rows < 1) {
+    ooc_band_rows = 1;
+  } else if (ooc_band_rows > size_y) {
+    ooc_band_rows = size_y;
+  }
+  ooc_band_count = (size_y + ooc_band_rows - 1) / ooc_band_rows;
+  const size_t band_size = (size_t)ooc_band_rows * size_x * sizeof(stencil_t);
+  for (int i = 0; i < OOC_SLOTS; i++) {
+    ooc_in.slots[i] = malloc(band_size);
+    ooc_out.slots[i] = malloc(band_size);
+  }
+  pthread_mutex_init(&ooc_in.lock, NULL);
+  pthread_cond_init(&ooc_in.cond, NULL);
+  pthread_mutex_init(&ooc_out.lock, NULL);
+  pthread_cond_init(&ooc_out.cond, NULL);
+  // enough rows for the threads, and for the fixed borders pushed at the
+  // end of a pass
+  ooc_block_rows = (OOC_BLOCK_CELLS + size_x - 1) / size_x;
+  if (ooc_block_rows < omp_get_max_threads()) {
+    ooc_block_rows = omp_get_max_threads();
+  }
+  if (ooc_block_rows < STENCIL_RADIUS) {
+    ooc_block_rows = STENCIL_RADIUS;
+  }
+  if (ooc_block_rows > size_y) {
+    ooc_block_rows = size_y;
+  }
+  ooc_levels = malloc((size_t)(ooc_steps + 1) *
+                      (ooc_block_rows + 2 * STENCIL_RADIUS) * size_x *
+                      sizeof(stencil_t));
+  ooc_level_y = malloc((ooc_steps + 1) * sizeof(int));
+  ooc_level_rows = malloc((ooc_steps + 1) * sizeof(int));
+  ooc_converged = malloc((ooc_steps + 1) * sizeof(int));
+
+  stencil_t *band = ooc_in.slots[0];
+  for (int b = 0; b < ooc_band_count; b++) {
+    int y0 = b * ooc_band_rows;
+    int rows = ooc_band_size(b);
+    memset(band, 0, (size_t)rows * size_x * sizeof(stencil_t));
+    for (int y = y0; y < y0 + rows; y++) {
+      stencil_t *row = &band[(y - y0) * size_x];
+      if (y < STENCIL_RADIUS || y >= size_y - STENCIL_RADIUS) {
+        for (int x = 0; x < size_x; x++) {
+          row[x] = y < STENCIL_RADIUS ? x : size_x - 1 - x;
+        }
+      }
+      for (int x = 0; x < STENCIL_RADIUS; x++) {
+        row[x] = y;
+        row[size_x - 1 - x] = size_y - 1 - y;
+      }
+    }
+    ooc_io(ooc_fd[0], band, y0, rows, 1);
+  }
+}
+
+/** run until convergence, return the step count of the in-memory loop. A
+ * pass that converges before its last level is run again up to that level,
+ * so the field is the one the in-memory loop stops on. */
+static int ooc_solve(void) {
+  int t = 0;
+  while (t < stencil_max_steps) {
+    int depth = stencil_max_steps - t < ooc_steps ? stencil_max_steps - t
+                                                  : ooc_steps;
+    int k = ooc_pass(depth);
+    if (k > 0 && k < depth) {
+      depth = k;
+      ooc_pass(depth);
+      ooc_repeats++;
+    }
+    ooc_src = !ooc_src;
+    t += depth;
+    if (k > 0) {
+      return t - 1;
+    }
+  }
+  return stencil_max_steps;
+}
+
+/** leave the field in the file named by -O, optionally loaded in values */
+static void ooc_finish(int load) {
+  if (load) {
+    values = malloc(size_x * size_y * sizeof(stencil_t));
+    ooc_io(ooc_fd[ooc_src], values, 0, size_y, 0);
+  }
+  close(ooc_fd[0]);
+  close(ooc_fd[1]);
+  if (ooc_src) {
+    rename(ooc_scratch_path, ooc_path);
+  } else {
+    unlink(ooc_scratch_path);
+  }
+  for (int i = 0; i < OOC_SLOTS; i++) {
+    free(ooc_in.slots[i]);
+    free(ooc_out.slots[i]);
+  }
+  pthread_mutex_destroy(&ooc_in.lock);
+  pthread_cond_destroy(&ooc_in.cond);
+  pthread_mutex_destroy(&ooc_out.lock);
+  pthread_cond_destroy(&ooc_out.cond);
+  free(ooc_levels);
+  free(ooc_level_y);
+  free(ooc_level_rows);
+  free(ooc_converged);
+  free(ooc_scratch_path);
+}
+
+/** path of the wisdom file, overridden by $STENCIL_WISDOM */
+static const char *wisdom_path(void) {
+  const char *path = getenv("STENCIL_WISDOM");
+  return path != NULL ? path : "stencil.wisdom";
+}
+
+/** find the configuration stored for key, return 0 if there is none */
+static int wisdom_load(const char *key, char *config, size_t len) {
+  FILE *file = fopen(wisdom_path(), "r");
+  if (file == NULL) {
+    return 0;
+  }
+  char line[512];
+  size_t key_len = strlen(key);
+  int found = 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (strncmp(line, key, key_len) == 0 && line[key_len] == ' ') {
+      line[strcspn(line, "\n")] = '\0';
+      snprintf(config, len, "%s", &line[key_len + 1]);
+      found = 1;
+    }
+  }
+  fclose(file);
+  return found;
+}
+
+/** replace the configuration stored for key in the wisdom file */
+static void wisdom_store(const char *key, const char *config) {
+  char tmp_path[512];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", wisdom_path());
+  FILE *out = fopen(tmp_path, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Cannot write wisdom file %s\n", tmp_path);
+    return;
+  }
+  FILE *in = fopen(wisdom_path(), "r");
+  if (in != NULL) {
+    char line[512];
+    size_t key_len = strlen(key);
+    while (fgets(line, sizeof(line), in) != NULL) {
+      if (!(strncmp(line, key, key_len) == 0 && line[key_len] == ' ')) {
+        fputs(line, out);
+      }
+    }
+    fclose(in);
+  }
+  fprintf(out, "%s %s\n", key, config);
+  fclose(out);
+  rename(tmp_path, wisdom_path());
+}
+
+/** wisdom key of this run: binary, grid size, stencil and machine */
+static void wisdom_key(char *key, size_t len) {
+  char host[64];
+  gethostname(host, sizeof(host));
+  host[sizeof(host) - 1] = '\0';
+  snprintf(key, len, "stencil_omp size=%d stencil=%s host=%s procs=%d",
+           size_x, STENCIL_NAME, host, omp_get_num_procs());
+}
+
+/** time a few steps from the initial field, return usecs/step */
+static double autotune_trial(void) {
+  stencil_init();
+  struct timespec t1, t2;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  int s;
+  int convergence = 0;
+  for (s = 0; s < autotune_steps && !convergence; s++) {
+    convergence = stencil_step_omp();
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t2);
+  stencil_free();
+  return ((t2.tv_sec - t1.tv_sec) * 1000000.0 +
+          (t2.tv_nsec - t1.tv_nsec) / 1000.0) /
+         s;
+}
+
+/** try doubling thread counts up to the maximum with each tile shape, keep
+ * and store the fastest */
+static void autotune(void) {
+  int max_threads = omp_get_max_threads();
+  double best_usec = 0.0;
+  int best_threads = max_threads;
+  int best_tile[2] = {tile_x, tile_y};
+  for (int t = 1;; t = 2 * t < max_threads ? 2 * t : max_threads) {
+    for (int i = 0; i < autotune_tile_count; i++) {
+      omp_set_num_threads(t);
+      tile_x = autotune_tiles[i][0];
+      tile_y = autotune_tiles[i][1];
+      double usec = autotune_trial();
+      printf("# trial threads = %d tile = %dx%d: %g usecs/step\n", t, tile_x,
+             tile_y, usec);
+      if (best_usec == 0.0 || usec < best_usec) {
+        best_usec = usec;
+        best_threads = t;
+        best_tile[0] = tile_x;
+        best_tile[1] = tile_y;
+      }
+    }
+    if (t >= max_threads) {
+      break;
+    }
+  }
+  omp_set_num_threads(best_threads);
+  tile_x = best_tile[0];
+  tile_y = best_tile[1];
+
+  char key[256], config[256];
+  wisdom_key(key, sizeof(key));
+  snprintf(config, sizeof(config), "threads=%d tile=%dx%d usec=%g",
+           best_threads, tile_x, tile_y, best_usec);
+  wisdom_store(key, config);
+  printf("# wisdom stored: %s %s\n", key, config);
+}
+
+/** apply the configuration stored in the wisdom file for this run, if any */
+static void wisdom_apply(void) {
+  char key[256], line[256];
+  int threads, tile[2];
+  wisdom_key(key, sizeof(key));
+  if (!wisdom_load(key, line, sizeof(line))) {
+    return;
+  }
+  int fields = sscanf(line, "threads=%d tile=%dx%d", &threads, &tile[0],
+                      &tile[1]);
+  if (fields < 1 || threads <= 0) {
+    return;
+  }
+  printf("# wisdom loaded: %s %s\n", key, line);
+  // explicit settings win over the stored ones
+  if (getenv("OMP_NUM_THREADS") != NULL) {
+    printf("# wisdom threads ignored, OMP_NUM_THREADS is set\n");
+  } else {
+    omp_set_num_threads(threads);
+  }
+  if (fields == 3 && tile_set) {
+    printf("# wisdom tile ignored, -b is set\n");
+  } else if (fields == 3) {
+    tile_x = tile[0];
+    tile_y = tile[1];
+  }
+}
+
 int main(int argc, char **argv) {
 
   int stencil_size = 10;
   int test_mode = 0;
+  int autotune_mode = 0;
 
   int opt;
-  while ((opt = getopt(argc, argv, "t")) != -1) {
+  while ((opt = getopt(argc, argv, "tiakb:A:O:K:m:")) != -1) {
     switch (opt) {
     case 't':
       test_mode = 1;
       break;
+    case 'i':
+      inplace_mode = 1;
+      break;
+    case 'a':
+      autotune_mode = 1;
+      break;
+    case 'k':
+      chebyshev_mode = 1;
+      break;
+    case 'b':
+      tile_set = sscanf(optarg, "%dx%d", &tile_x, &tile_y) == 2;
+      break;
+    case 'A':
+      adi_factor = atof(optarg);
+      break;
+    case 'O':
+      ooc_path = optarg;
+      break;
+    case 'K':
+      ooc_steps = atoi(optarg);
+      break;
+    case 'm':
+      mask_path = optarg;
+      break;
     default:
-      fprintf(stderr, "Usage: %s [stencil size] [-t]\n", argv[0]);
+      fprintf(stderr,
+              "Usage: %s [stencil size] [-t] [-i] [-a] [-k] [-b tile XxY] "
+              "[-A ADI step factor] [-O out-of-core file] "
+              "[-K steps per pass] [-m mask PGM file]\n",
+              argv[0]);
       return EXIT_FAILURE;
     }
   }
   if (optind < argc) {
     stencil_size = atoi(argv[optind]);
-    if (stencil_size < 2) {
-      fprintf(stderr, "Stencil size must be >= 2. Using default (10).\n");
+    if (stencil_size < 2 * STENCIL_RADIUS) {
+      fprintf(stderr, "Stencil size must be >= %d. Using default (10).\n",
+              2 * STENCIL_RADIUS);
       stencil_size = 10;
     }
   }
 
+  if (adi_factor > 0.0 && STENCIL != STENCIL_STAR5) {
+    fprintf(stderr, "ADI steps need the star5 stencil.\n");
+    return EXIT_FAILURE;
+  }
+  if (adi_factor > 0.0 && inplace_mode) {
+    fprintf(stderr, "In-place steps are explicit, without -A.\n");
+    return EXIT_FAILURE;
+  }
+
+  if (ooc_path != NULL &&
+      (adi_factor > 0.0 || inplace_mode || autotune_mode)) {
+    fprintf(stderr,
+            "Out-of-core steps are explicit, without -A, -i or -a.\n");
+    return EXIT_FAILURE;
+  }
+  if (chebyshev_mode && (adi_factor > 0.0 || inplace_mode || ooc_path)) {
+    fprintf(stderr, "Chebyshev steps need two fields in memory, without -A, "
+                    "-i or -O.\n");
+    return EXIT_FAILURE;
+  }
+  if (mask_path != NULL && (adi_factor > 0.0 || ooc_path != NULL)) {
+    fprintf(stderr, "Masked domains run in memory without -A or -O.\n");
+    return EXIT_FAILURE;
+  }
+  if (ooc_steps < 1) {
+    ooc_steps = 1;
+  }
+
   size_x = stencil_size;
   size_y = stencil_size;
+  if (adi_factor > 0.0) {
+    adi_setup();
+  }
+  if (setup_runs() != 0) {
+    return EXIT_FAILURE;
+  }
 
-  stencil_init();
+  if (autotune_mode) {
+    autotune();
+  } else {
+    wisdom_apply();
+  }
+
+  if (ooc_path != NULL) {
+    ooc_init();
+  } else {
+    stencil_init();
+  }
   printf("# init:\n");
 
   struct timespec t1, t2;
   clock_gettime(CLOCK_MONOTONIC, &t1);
+  if (chebyshev_mode) {
+    chebyshev_reset();
+  }
   int s;
-  for (s = 0; s < stencil_max_steps; s++) {
-    int convergence = stencil_step_omp();
-    if (convergence) {
-      break;
+  if (ooc_path != NULL) {
+    s = ooc_solve();
+  } else {
+    for (s = 0; s < stencil_max_steps; s++) {
+      int convergence = stencil_step_omp();
+      if (convergence) {
+        if (chebyshev_mode) {
+          // keep the input of the last step, whose residual was tested
+          stencil_t *tmp = prev_values;
+          prev_values = values;
+          values = tmp;
+        }
+        break;
+      }
     }
   }
   clock_gettime(CLOCK_MONOTONIC, &t2);
   const double t_usec =
       (t2.tv_sec - t1.tv_sec) * 1000000.0 + (t2.tv_nsec - t1.tv_nsec) / 1000.0;
   printf("# size = %d\n", stencil_size);
+  printf("# stencil = %s\n", STENCIL_NAME);
   printf("# steps = %d\n", s);
   printf("# time = %g usecs.\n", t_usec);
-  printf("# gflops = %g\n", (6.0 * size_x * size_y * s) / (t_usec * 1000));
+  printf("# gflops = %g\n",
+         (STENCIL_FLOPS * (double)size_x * size_y * s) / (t_usec * 1000));
+  if (mask_path != NULL) {
+    printf("# mask = %s, %ld / %ld active cells\n", mask_path, active_cells,
+           (long)(size_x - 2 * STENCIL_RADIUS) * (size_y - 2 * STENCIL_RADIUS));
+  }
+  if (chebyshev_mode) {
+    printf("# chebyshev bounds = [%g, %g]\n", chebyshev_bounds[0],
+           chebyshev_bounds[1]);
+  }
+  if (ooc_path != NULL) {
+    printf("# out-of-core = %s, %d steps per pass, %d rows per band, %d "
+           "per block\n",
+           ooc_path, ooc_steps, ooc_band_rows, ooc_block_rows);
+    printf("# ooc passes = %d, %d repeated to stop on convergence\n",
+           ooc_passes, ooc_repeats);
+    // the initial field is written once, then each pass reads and writes it
+    double traffic =
+        (2.0 * ooc_passes + 1) * size_x * size_y * sizeof(stencil_t);
+    printf("# ooc traffic = %g MB, %g MB/s\n", traffic / 1e6,
+           traffic / t_usec);
+    printf("# ooc io wait = %g usecs.\n", ooc_wait_usec);
+    ooc_finish(test_mode);
+  }
 
-  if (test_mode) {
+  if (test_mode && (adi_factor > 0.0 || chebyshev_mode)) {
+    // ADI and Chebyshev stop at another distance from the steady state than
+    // the explicit reference, so only the residual of the result is checked
+    double residual = 0.0;
+#pragma omp parallel for reduction(max : residual)
+    for (int y = STENCIL_RADIUS; y < size_y - STENCIL_RADIUS; y++) {
+      for (int i = row_runs[y - STENCIL_RADIUS];
+           i < row_runs[y - STENCIL_RADIUS + 1]; i++) {
+        for (int x = runs[2 * i]; x < runs[2 * i + 1]; x++) {
+          double next = STENCIL_APPLY(&values[x + size_x * y], size_x, alpha);
+          double change = fabs(next - values[x + size_x * y]);
+          if (change > residual) {
+            residual = change;
+          }
+        }
+      }
+    }
     printf("Test mode\n");
-    stencil_display(0, size_x - 1, 0, size_y - 1);
+    printf("# verify residual = %g\n", residual);
+    if (residual > epsilon) {
+      printf("Results do not match!\n");
+    } else {
+      printf("Results match perfectly.\n");
+    }
+  } else if (test_mode) {
     stencil_t *test_values = malloc(size_x * size_y * sizeof(stencil_t));
     memcpy(test_values, values, size_x * size_y * sizeof(stencil_t));
+    int steps = s;
     stencil_free();
+    inplace_mode = 0; // the reference runs on two fields
     stencil_init();
     for (s = 0; s < stencil_max_steps; s++) {
       int convergence = stencil_step();
@@ -172,26 +1356,41 @@ int main(int argc, char **argv) {
       }
     }
 
-    int mismatch = 0;
-    int x, y;
-    for (x = 0; x < size_x; x++) {
-      for (y = 0; y < size_y; y++) {
-        if (fabs(values[x + size_x * y] - test_values[x + size_x * y]) >
-            epsilon) {
-          mismatch = 1;
-          printf("Mismatch at (%d, %d): seq = %g, test = %g\n", x, y,
-                 values[x + size_x * y], test_values[x + size_x * y]);
+    long mismatches = 0;
+    double max_error = -1.0;
+    int max_x = 0, max_y = 0;
+    for (int y = 0; y < size_y; y++) {
+      for (int x = 0; x < size_x; x++) {
+        double error =
+            fabs(values[x + size_x * y] - test_values[x + size_x * y]);
+        if (error > epsilon) {
+          mismatches++;
+        }
+        if (error > max_error) {
+          max_error = error;
+          max_x = x;
+          max_y = y;
         }
       }
     }
-    if (mismatch) {
-      printf("Results do not match! Expected:\n");
-      stencil_display(0, size_x - 1, 0, size_y - 1);
+    printf("Test mode\n");
+    printf("# verify steps = %d, reference steps = %d\n", steps, s);
+    printf("# verify mismatches = %ld / %d cells\n", mismatches,
+           size_x * size_y);
+    printf("# verify max error = %g at (%d, %d)\n", max_error, max_x, max_y);
+    if (mismatches) {
+      printf("Results do not match!\n");
     } else {
       printf("Results match perfectly.\n");
     }
     free(test_values);
   }
   stencil_free();
+  tile_release();
+  free(row_runs);
+  free(runs);
+  if (adi_factor > 0.0) {
+    adi_free();
+  }
   return 0;
 }
@@ -1,4 +1,5 @@
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,7 +8,8 @@
 #include <getopt.h>
 #include <unistd.h>
 
-typedef float stencil_t;
+#include "stencil.h"
+#include "stencil_inplace.h"
 
 /** conduction coeff used in computation */
 static const stencil_t alpha = 0.02;
@@ -21,13 +23,38 @@ static const int stencil_max_steps = 100000;
 static stencil_t *values = NULL;
 static stencil_t *prev_values = NULL;
 
+/** in-place steps: a single field and a rolling window of old rows */
+static int inplace_mode = 0;
+static stencil_t *inplace_window = NULL;
+
 static int size_x; // = STENCIL_SIZE;
 static int size_y; // = STENCIL_SIZE;
 
-/** init stencil values to 0, borders to non-zero */
+/** Chebyshev acceleration (-k): x' = x + w[0] (x - x_prev) + w[1] (J(x) - x),
+ * J being the Jacobi update, with weights from bounds of its spectrum */
+static int chebyshev_mode = 0;
+#define CHEBYSHEV_SAMPLES 32       // modes sampled along each axis
+static double chebyshev_bounds[2]; // min and max eigenvalues of J
+static double chebyshev_rho;       // of the previous step, 0 before the first
+static stencil_t chebyshev_w[2];   // weights of the current step
+
+/** masked domain (-m): the active cells as runs of contiguous columns, the
+ * runs of row y being row_runs[y - STENCIL_RADIUS] to
+ * row_runs[y - STENCIL_RADIUS + 1] and run i covering the columns
+ * runs[2 * i] to runs[2 * i + 1]. Without a mask, every row is one run. */
+static const char *mask_path = NULL; // PGM geometry mask, NULL = rectangle
+static int *row_runs = NULL;
+static int *runs = NULL;
+static long active_cells = 0;
+
+/** init stencil values to 0, borders of STENCIL_RADIUS cells to non-zero */
 static void stencil_init(void) {
   values = malloc(size_x * size_y * sizeof(stencil_t));
-  prev_values = malloc(size_x * size_y * sizeof(stencil_t));
+  if (inplace_mode) {
+    inplace_window = malloc(2 * INPLACE_ROWS * size_x * sizeof(stencil_t));
+  } else {
+    prev_values = malloc(size_x * size_y * sizeof(stencil_t));
+  }
   int x, y;
   // init all to 0
   for (x = 0; x < size_x; x++) {
@@ -36,23 +63,111 @@ static void stencil_init(void) {
     }
   }
   // set borders up and down
-  for (x = 0; x < size_x; x++) {
-    values[x + size_x * 0] = x;
-    values[x + size_x * (size_y - 1)] = size_x - 1 - x;
+  for (y = 0; y < STENCIL_RADIUS; y++) {
+    for (x = 0; x < size_x; x++) {
+      values[x + size_x * y] = x;
+      values[x + size_x * (size_y - 1 - y)] = size_x - 1 - x;
+    }
   }
   // set borders left and right
   for (y = 0; y < size_y; y++) {
-    values[0 + size_x * y] = y;
-    values[(size_x - 1) + size_x * y] = size_y - 1 - y;
+    for (x = 0; x < STENCIL_RADIUS; x++) {
+      values[x + size_x * y] = y;
+      values[(size_x - 1 - x) + size_x * y] = size_y - 1 - y;
+    }
   }
   // copy to prev_values for the first step
-  memcpy(prev_values, values, size_x * size_y * sizeof(stencil_t));
+  if (prev_values != NULL) {
+    memcpy(prev_values, values, size_x * size_y * sizeof(stencil_t));
+  }
+}
+
+/** runs of the active cells of the interior in mask; return the run count,
+ * only counted if out is NULL */
+static int mask_runs(const uint8_t *mask, int *starts, int *out) {
+  const int nx = size_x - 2 * STENCIL_RADIUS;
+  const int ny = size_y - 2 * STENCIL_RADIUS;
+  int count = 0;
+  for (int y = 0; y < ny; y++) {
+    const uint8_t *row = &mask[STENCIL_RADIUS + size_x * (y + STENCIL_RADIUS)];
+    starts[y] = count;
+    for (int x = 0; x < nx; x++) {
+      if (row[x] && (x == 0 || !row[x - 1])) {
+        if (out != NULL) {
+          out[2 * count] = x + STENCIL_RADIUS;
+        }
+      }
+      if (row[x] && (x == nx - 1 || !row[x + 1])) {
+        if (out != NULL) {
+          out[2 * count + 1] = x + 1 + STENCIL_RADIUS;
+        }
+        count++;
+      }
+    }
+  }
+  starts[ny] = count;
+  return count;
+}
+
+/** build the runs of the interior: one per row without a mask, else from
+ * the binary PGM (P5) mask of the whole grid, borders included, whose
+ * nonzero pixels are the active cells; the others keep their initial value
+ * like the borders. Return -1 if the mask cannot be read. */
+static int setup_runs(void) {
+  const int ny = size_y - 2 * STENCIL_RADIUS;
+  row_runs = malloc((ny + 1) * sizeof(int));
+  if (mask_path == NULL) {
+    runs = malloc(2 * ny * sizeof(int));
+    for (int y = 0; y <= ny; y++) {
+      row_runs[y] = y;
+    }
+    for (int y = 0; y < ny; y++) {
+      runs[2 * y] = STENCIL_RADIUS;
+      runs[2 * y + 1] = size_x - STENCIL_RADIUS;
+    }
+    active_cells = (long)(size_x - 2 * STENCIL_RADIUS) * ny;
+    return 0;
+  }
+
+  FILE *in = fopen(mask_path, "rb");
+  int width, height, maxval;
+  if (in == NULL ||
+      fscanf(in, "P5 %d %d %d", &width, &height, &maxval) != 3 ||
+      width != size_x || height != size_y || maxval > 255 ||
+      fgetc(in) == EOF) {
+    fprintf(stderr, "%s: not a %dx%d 8-bit PGM mask\n", mask_path, size_x,
+            size_y);
+    if (in != NULL) {
+      fclose(in);
+    }
+    return -1;
+  }
+  uint8_t *mask = malloc((size_t)size_x * size_y);
+  size_t read = fread(mask, 1, (size_t)size_x * size_y, in);
+  fclose(in);
+  if (read != (size_t)size_x * size_y) {
+    fprintf(stderr, "%s: truncated mask\n", mask_path);
+    free(mask);
+    return -1;
+  }
+  int count = mask_runs(mask, row_runs, NULL);
+  runs = malloc((2 * count + 1) * sizeof(int));
+  mask_runs(mask, row_runs, runs);
+  free(mask);
+  active_cells = 0;
+  for (int i = 0; i < count; i++) {
+    active_cells += runs[2 * i + 1] - runs[2 * i];
+  }
+  return 0;
 }
 
 /** free stencil values */
 static void stencil_free(void) {
   free(values);
   free(prev_values);
+  free(inplace_window);
+  free(row_runs);
+  free(runs);
 }
 
 /** display a (part of) the stencil values */
@@ -78,19 +193,19 @@ static int stencil_step(void) {
 
   // compute next stencil
   int x, y;
-  // skip borders
-  for (y = 1; y < size_y - 1; y++) {
-    for (x = 1; x < size_x - 1; x++) {
-      values[x + size_x * y] = // alpha is the conduction coeff
-          alpha * (prev_values[x - 1 + size_x * y] +         // left transfer
-                   prev_values[x + 1 + size_x * y] +         // right transfer
-                   prev_values[x + size_x * (y - 1)] +       // top transfer
-                   prev_values[x + size_x * (y + 1)]) +      // bottom transfer
-          (1.0 - 4.0 * alpha) * prev_values[x + size_x * y]; // center loss
-      // check convergence
-      if (convergence && (fabs(prev_values[x + size_x * y] -
-                               values[x + size_x * y]) > epsilon)) {
-        convergence = 0;
+  // skip borders, and the inactive cells run by run
+  for (y = STENCIL_RADIUS; y < size_y - STENCIL_RADIUS; y++) {
+    for (int i = row_runs[y - STENCIL_RADIUS];
+         i < row_runs[y - STENCIL_RADIUS + 1]; i++) {
+      for (x = runs[2 * i]; x < runs[2 * i + 1]; x++) {
+        // weighted transfers from the neighbours, alpha is the conduction coeff
+        values[x + size_x * y] =
+            STENCIL_APPLY(&prev_values[x + size_x * y], size_x, alpha);
+        // check convergence
+        if (convergence && (fabs(prev_values[x + size_x * y] -
+                                 values[x + size_x * y]) > epsilon)) {
+          convergence = 0;
+        }
       }
     }
   }
@@ -98,6 +213,86 @@ static int stencil_step(void) {
   return convergence;
 }
 
+/** compute the next stencil step in place with the rolling window of
+ * stencil_inplace.h, return 1 if computation has converged; the results are
+ * those of stencil_step() */
+static int stencil_step_inplace(void) {
+  return inplace_tile(values, size_x, STENCIL_RADIUS, size_x - STENCIL_RADIUS,
+                      STENCIL_RADIUS, size_y - STENCIL_RADIUS, values,
+                      &values[size_x * (size_y - STENCIL_RADIUS)], NULL,
+                      inplace_window, row_runs, runs, alpha, epsilon);
+}
+
+/** bound the spectrum of J on the interior by its symbol at Dirichlet modes
+ * sampled from the slowest to the fastest, and restart the recurrence */
+static void chebyshev_reset(void) {
+  const int n[2] = {size_x - 2 * STENCIL_RADIUS, size_y - 2 * STENCIL_RADIUS};
+  chebyshev_bounds[0] = INFINITY;
+  chebyshev_bounds[1] = -INFINITY;
+  for (int i = 0; i < CHEBYSHEV_SAMPLES; i++) {
+    for (int j = 0; j < CHEBYSHEV_SAMPLES; j++) {
+      int k[2] = {1 + i * (n[0] - 1) / (CHEBYSHEV_SAMPLES - 1),
+                  1 + j * (n[1] - 1) / (CHEBYSHEV_SAMPLES - 1)};
+      double t[2] = {M_PI * k[0] / (n[0] + 1), M_PI * k[1] / (n[1] + 1)};
+      double g = STENCIL_SYMBOL(t, alpha);
+      chebyshev_bounds[0] = g < chebyshev_bounds[0] ? g : chebyshev_bounds[0];
+      chebyshev_bounds[1] = g > chebyshev_bounds[1] ? g : chebyshev_bounds[1];
+    }
+  }
+  chebyshev_rho = 0.0;
+}
+
+/** weights of the next step of the Chebyshev recurrence for I - J, whose
+ * spectrum lies in theta +- delta */
+static void chebyshev_next(void) {
+  const double theta = 1.0 - (chebyshev_bounds[0] + chebyshev_bounds[1]) / 2;
+  double delta = (chebyshev_bounds[1] - chebyshev_bounds[0]) / 2;
+  if (delta < 1e-12) {
+    delta = 1e-12;
+  }
+  const double sigma = theta / delta;
+  if (chebyshev_rho == 0.0) {
+    chebyshev_rho = 1.0 / sigma;
+    chebyshev_w[0] = 0.0;
+    chebyshev_w[1] = 1.0 / theta;
+  } else {
+    double rho = 1.0 / (2.0 * sigma - chebyshev_rho);
+    chebyshev_w[0] = rho * chebyshev_rho;
+    chebyshev_w[1] = 2.0 * rho / delta;
+    chebyshev_rho = rho;
+  }
+}
+
+/** compute the next Chebyshev step, return 1 if computation has converged.
+ * values still holds the field of the step before prev_values, read by
+ * each cell just before it is overwritten. */
+static int stencil_step_chebyshev(void) {
+  int convergence = 1;
+  stencil_t *tmp = prev_values;
+  prev_values = values;
+  values = tmp;
+  chebyshev_next();
+  const stencil_t w0 = chebyshev_w[0], w1 = chebyshev_w[1];
+  int x, y;
+  for (y = STENCIL_RADIUS; y < size_y - STENCIL_RADIUS; y++) {
+    for (int i = row_runs[y - STENCIL_RADIUS];
+         i < row_runs[y - STENCIL_RADIUS + 1]; i++) {
+      for (x = runs[2 * i]; x < runs[2 * i + 1]; x++) {
+        stencil_t cur = prev_values[x + size_x * y];
+        // change of a plain Jacobi step, tested for convergence as in it
+        stencil_t change =
+            STENCIL_APPLY(&prev_values[x + size_x * y], size_x, alpha) - cur;
+        values[x + size_x * y] =
+            cur + w0 * (cur - values[x + size_x * y]) + w1 * change;
+        if (convergence && fabs(change) > epsilon) {
+          convergence = 0;
+        }
+      }
+    }
+  }
+  return convergence;
+}
+
 /** main function */
 int main(int argc, char **argv) {
   int stencil_size = 10;
@@ -105,20 +300,36 @@ int main(int argc, char **argv) {
 
   // Parse command line options
   int opt;
-  while ((opt = getopt(argc, argv, "t")) != -1) {
+  while ((opt = getopt(argc, argv, "tikm:")) != -1) {
     switch (opt) {
     case 't':
       test_mode = 1;
       break;
+    case 'i':
+      inplace_mode = 1;
+      break;
+    case 'k':
+      chebyshev_mode = 1;
+      break;
+    case 'm':
+      mask_path = optarg;
+      break;
     default:
-      fprintf(stderr, "Usage: %s [stencil size] [-t]\n", argv[0]);
+      fprintf(stderr,
+              "Usage: %s [stencil size] [-t] [-i] [-k] [-m mask PGM file]\n",
+              argv[0]);
       return EXIT_FAILURE;
     }
   }
+  if (inplace_mode && chebyshev_mode) {
+    fprintf(stderr, "Chebyshev steps need two fields, without -i.\n");
+    return EXIT_FAILURE;
+  }
   if (optind < argc) {
     stencil_size = atoi(argv[optind]);
-    if (stencil_size < 2) {
-      fprintf(stderr, "Stencil size must be >= 2. Using default (10).\n");
+    if (stencil_size < 2 * STENCIL_RADIUS) {
+      fprintf(stderr, "Stencil size must be >= %d. Using default (10).\n",
+              2 * STENCIL_RADIUS);
       stencil_size = 10;
     }
   }
@@ -127,6 +338,10 @@ int main(int argc, char **argv) {
   size_x = stencil_size;
   size_y = stencil_size;
   stencil_init();
+  if (setup_runs() != 0) {
+    stencil_free();
+    return EXIT_FAILURE;
+  }
 
   printf("# init:\n");
 
@@ -137,10 +352,22 @@ int main(int argc, char **argv) {
   // Run stencil computation
   struct timespec t1, t2;
   clock_gettime(CLOCK_MONOTONIC, &t1);
+  if (chebyshev_mode) {
+    chebyshev_reset();
+  }
   int s;                                    // step
   for (s = 0; s < stencil_max_steps; s++) { // max number of steps
-    int convergence = stencil_step();       // compute next stencil step
+    // compute next stencil step
+    int convergence = chebyshev_mode ? stencil_step_chebyshev()
+                      : inplace_mode ? stencil_step_inplace()
+                                     : stencil_step();
     if (convergence) {                      // if computation has converged
+      if (chebyshev_mode) {
+        // keep the input of the last step, whose residual was tested
+        stencil_t *tmp = prev_values;
+        prev_values = values;
+        values = tmp;
+      }
       break;                                // stop
     }
   }
@@ -150,9 +377,19 @@ int main(int argc, char **argv) {
   const double t_usec =
       (t2.tv_sec - t1.tv_sec) * 1000000.0 + (t2.tv_nsec - t1.tv_nsec) / 1000.0;
   printf("# size = %d\n", stencil_size);
+  printf("# stencil = %s\n", STENCIL_NAME);
   printf("# steps = %d\n", s);
   printf("# time = %g usecs.\n", t_usec);
-  printf("# gflops = %g\n", (6.0 * size_x * size_y * s) / (t_usec * 1000));
+  printf("# gflops = %g\n",
+         (STENCIL_FLOPS * (double)size_x * size_y * s) / (t_usec * 1000));
+  if (mask_path != NULL) {
+    printf("# mask = %s, %ld / %ld active cells\n", mask_path, active_cells,
+           (long)(size_x - 2 * STENCIL_RADIUS) * (size_y - 2 * STENCIL_RADIUS));
+  }
+  if (chebyshev_mode) {
+    printf("# chebyshev bounds = [%g, %g]\n", chebyshev_bounds[0],
+           chebyshev_bounds[1]);
+  }
 
   // Display final stencil
   if (test_mode) {